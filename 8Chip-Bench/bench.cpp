@@ -0,0 +1,1229 @@
+// My 8 Chip-Emu benchmarks
+// Micro and macro benchmarks for the chip8 core, every suite prints a small table to stdout.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include "chip8.h"
+#include "framebuffer.h"
+#include "gfxsimd.h"
+#include "host.h"
+#include "batch.h"
+#include "rewind.h"
+#include "romfile.h"
+#include "romindex.h"
+#include "scheduler.h"
+
+// Default instructions per ROM
+#define DEFAULT_CYCLES 10000000
+
+typedef std::chrono::steady_clock Clock;
+
+static void printUsage()
+{
+	printf("usage: 8chip-bench.exe suite [options]\n\n");
+	printf("Suites:\n");
+	printf("  dispatch ROM... [-c cycles]   Instructions per second decoding with the switch vs the decode table\n");
+	printf("  engines ROM... [-c cycles]    Instructions per second of every engine, checked against the interpreter\n");
+	printf("  diff [-e engine] [-c cycles] [-r programs] [ROM...]\n");
+	printf("                                Run an engine in lockstep with the interpreter on ROMs and random programs\n");
+	printf("  idle [-s ips] [-f frames]     Share of the instructions skipped in idle loops, checked against running them\n");
+	printf("  batch [-l lanes] [-c cycles] [-r programs] [ROM...]\n");
+	printf("                                Run machines with different seeds in a lockstep batch and one by one, comparing both\n");
+	printf("  snapshot ROM... [-c cycles] [-n iterations]\n");
+	printf("                                Size of the save states and microseconds to take and restore them\n");
+	printf("  fork ROM... [-c cycles] [-n forks]\n");
+	printf("                                Forks per second of a running machine, each fork then runs 100 instructions\n");
+	printf("  rewind ROM... [-f frames] [-c cycles per frame]\n");
+	printf("                                Rewind history size per frame and microseconds to go back a second\n");
+	printf("  load ROM... [-n loads]        Machines per second started from the ROM file and from the ROM index\n");
+	printf("  gfx [-n iterations]           Nanoseconds per call of every framebuffer kernel for each instruction set\n");
+	printf("  host ROM [-m machines] [-f frames] [-s ips] [-e engine]\n");
+	printf("                                Instructions per second of many machines on 1, 2, 4... threads\n");
+}
+
+static double secondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Parse "ROM... [-c cycles]", returns false on a bad option
+static bool parseRomArgs(int argc, char** argv, int first, std::vector<const char*>& roms, uint64_t& cycles)
+{
+	for (int i = first; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			cycles = strtoull(argv[++i], NULL, 10);
+		else if (argv[i][0] == '-')
+			return false;
+		else
+			roms.push_back(argv[i]);
+	}
+
+	return !roms.empty() && cycles > 0;
+}
+
+// Whole ROM file in memory, empty when it can't be read
+static std::vector<uint8_t> readRom(const char* filename)
+{
+	std::vector<uint8_t> data;
+
+	FILE* pFile = openFile(filename, "rb");
+	if (pFile == NULL)
+		return data;
+
+	uint8_t buffer[4096];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+		data.insert(data.end(), buffer, buffer + n);
+
+	fclose(pFile);
+	return data;
+}
+
+// Runs every ROM once through the switch decoder and once through the decode table
+static int benchDispatch(int argc, char** argv)
+{
+	std::vector<const char*> roms;
+	uint64_t cycles = DEFAULT_CYCLES;
+	if (!parseRomArgs(argc, argv, 2, roms, cycles))
+	{
+		printUsage();
+		return 1;
+	}
+
+	printf("%-32s %14s %14s %8s\n", "ROM", "switch IPS", "table IPS", "speedup");
+
+	for (const char* rom : roms)
+	{
+		chip8* reference = new chip8();
+		chip8* table = new chip8();
+		if (!reference->loadApplication(rom) || !table->loadApplication(rom))
+		{
+			delete reference;
+			delete table;
+			return -1;
+		}
+
+		Clock::time_point start = Clock::now();
+		for (uint64_t n = 0; n < cycles; n++)
+			reference->emulateCycleSwitch();
+		double switchSeconds = secondsSince(start);
+
+		start = Clock::now();
+		for (uint64_t n = 0; n < cycles; n++)
+			table->emulateCycle();
+		double tableSeconds = secondsSince(start);
+
+		printf("%-32s %14.0f %14.0f %7.2fx\n", rom, cycles / switchSeconds, cycles / tableSeconds, switchSeconds / tableSeconds);
+
+		delete reference;
+		delete table;
+	}
+
+	return 0;
+}
+
+static bool parseEngine(const char* name, chip8Engine& engine)
+{
+	if (strcmp(name, "interpreter") == 0)
+		engine = chip8Engine::Interpreter;
+	else if (strcmp(name, "block") == 0)
+		engine = chip8Engine::BlockCache;
+	else if (strcmp(name, "jit") == 0)
+		engine = chip8Engine::Jit;
+	else
+		return false;
+
+	return true;
+}
+
+// Runs a ROM with the given engine, the random seed is reset so every engine sees the same CXNN results
+static double runEngine(chip8& c8, chip8Engine engine, uint64_t cycles)
+{
+	c8.setEngine(engine);
+	c8.seedRandom(1);
+
+	Clock::time_point start = Clock::now();
+	uint64_t executed = 0;
+	while (executed < cycles)
+	{
+		executed += c8.run(cycles - executed);
+		c8.DrawFlag = false;
+	}
+
+	return secondsSince(start);
+}
+
+// Runs every ROM with each engine and checks that they all end in the interpreter's state
+static int benchEngines(int argc, char** argv)
+{
+	std::vector<const char*> roms;
+	uint64_t cycles = DEFAULT_CYCLES;
+	if (!parseRomArgs(argc, argv, 2, roms, cycles))
+	{
+		printUsage();
+		return 1;
+	}
+
+	static const struct { chip8Engine Engine; const char* Name; } engines[] =
+	{
+		{ chip8Engine::Interpreter, "interpreter" },
+		{ chip8Engine::BlockCache, "block" },
+		{ chip8Engine::Jit, "jit" },
+	};
+	const int engineCount = sizeof(engines) / sizeof(engines[0]);
+
+	printf("%-32s %-12s %14s %8s %s\n", "ROM", "engine", "IPS", "speedup", "state");
+
+	int result = 0;
+	for (const char* rom : roms)
+	{
+		chip8* reference = new chip8();
+		if (!reference->loadApplication(rom))
+		{
+			delete reference;
+			return -1;
+		}
+
+		double referenceSeconds = runEngine(*reference, engines[0].Engine, cycles);
+		printf("%-32s %-12s %14.0f %7.2fx %s\n", rom, engines[0].Name, cycles / referenceSeconds, 1.0, "reference");
+
+		for (int e = 1; e < engineCount; e++)
+		{
+			chip8* c8 = new chip8();
+			c8->loadApplication(rom);
+
+			double seconds = runEngine(*c8, engines[e].Engine, cycles);
+			bool same = c8->sameState(*reference);
+			if (!same)
+				result = 2;
+
+			printf("%-32s %-12s %14.0f %7.2fx %s\n", rom, engines[e].Name, cycles / seconds, referenceSeconds / seconds, same ? "identical" : "MISMATCH");
+			delete c8;
+		}
+
+		delete reference;
+	}
+
+	return result;
+}
+
+// Small xorshift so the random programs are the same on every platform
+static uint32_t nextRandom(uint32_t& state)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+// Random program mixing the register instructions the JIT compiles with skips, jumps, timers,
+// sprite draws and memory stores that end blocks or overwrite code. BNNN, the key skips and FX0A
+// send machines with different V0 or keys different ways.
+static std::vector<uint8_t> randomProgram(uint32_t& state, int length)
+{
+	std::vector<uint8_t> program;
+
+	for (int n = 0; n < length - 1; n++)
+	{
+		const uint16_t x = nextRandom(state) & 0xF;
+		const uint16_t y = nextRandom(state) & 0xF;
+		const uint16_t nn = nextRandom(state) & 0xFF;
+		static const uint16_t alu[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+		uint16_t opcode;
+
+		switch (nextRandom(state) % 21)
+		{
+			case 0: case 1: opcode = 0x6000 | x << 8 | nn; break;
+			case 2: case 3: opcode = 0x7000 | x << 8 | nn; break;
+			case 4: case 5: case 6: case 7: opcode = 0x8000 | x << 8 | y << 4 | alu[nextRandom(state) % 9]; break;
+			case 8: opcode = 0xA000 | (0x200 + (nextRandom(state) % (length * 2))); break; // Point I at the program itself
+			case 9: opcode = 0xF01E | x << 8; break;
+			case 10: opcode = 0xF029 | x << 8; break;
+			case 11: opcode = (0x3000 + 0x1000 * (nextRandom(state) % 2)) | x << 8 | nn; break;
+			case 12: opcode = (0x5000 + 0x4000 * (nextRandom(state) % 2)) | x << 8 | y << 4; break;
+			case 13: opcode = 0x1000 | (0x200 + 2 * (nextRandom(state) % length)); break;
+			case 14: opcode = (nextRandom(state) % 2) ? (0xF033 | x << 8) : (0xF055 | x << 8); break;
+			case 15: opcode = (nextRandom(state) % 4) ? (0xF065 | x << 8) : (0xC000 | x << 8 | nn); break;
+			case 16: opcode = 0xD000 | x << 8 | y << 4 | (nextRandom(state) & 0xF); break;
+			case 17: opcode = 0xB000 | (0x200 + 2 * (nextRandom(state) % length)); break;
+			case 18: opcode = (nextRandom(state) % 2) ? (0xE09E | x << 8) : (0xE0A1 | x << 8); break;
+			case 19: opcode = 0xF00A | x << 8; break;
+			default: opcode = (nextRandom(state) % 2) ? (0xF065 | x << 8) : (0xF007 | x << 8); break;
+		}
+
+		program.push_back(opcode >> 8);
+		program.push_back(opcode & 0xFF);
+	}
+
+	// Loop back to the start
+	program.push_back(0x12);
+	program.push_back(0x00);
+	return program;
+}
+
+// Keys held during a chunk of a differential run, different for every lane and often none so
+// FX0A sees keys being released
+static uint16_t chunkKeys(uint64_t chunk, int lane)
+{
+	uint32_t state = (uint32_t)chunk * 0x9E3779B9u + (uint32_t)lane * 0x85EBCA6Bu + 1;
+	nextRandom(state);
+	return (state & 1) ? 0 : (uint16_t)(1 << (state >> 1 & 0xF));
+}
+
+// Runs the engine and the interpreter side by side, comparing the whole state after every run() call.
+// Returns the cycle where they first differed or 0 when they stayed identical.
+static uint64_t diffMachines(chip8& engine, chip8& reference, uint64_t cycles)
+{
+	// Same seed so CXNN gives both the same numbers, sameState compares the generators too
+	engine.seedRandom(0x8C1F);
+	reference.seedRandom(0x8C1F);
+
+	uint64_t executed = 0;
+	while (executed < cycles)
+	{
+		uint64_t n = engine.run(cycles - executed < 1000 ? cycles - executed : 1000);
+		engine.DrawFlag = false;
+
+		for (uint64_t i = 0; i < n; i++)
+			reference.emulateCycle();
+		reference.DrawFlag = false;
+
+		executed += n;
+		if (!engine.sameState(reference))
+			return executed;
+
+		// Timers tick between frames, do it between every run so FX07/FX15/FX18 see them move
+		engine.tickTimers();
+		reference.tickTimers();
+		engine.setKeys(chunkKeys(executed, 0));
+		reference.setKeys(chunkKeys(executed, 0));
+	}
+
+	return 0;
+}
+
+static int benchDiff(int argc, char** argv)
+{
+	std::vector<const char*> roms;
+	chip8Engine engine = chip8Engine::Jit;
+	uint64_t cycles = 1000000;
+	int programs = 0;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			cycles = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			programs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc && parseEngine(argv[i + 1], engine))
+			i++;
+		else if (argv[i][0] != '-')
+			roms.push_back(argv[i]);
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (roms.empty() && programs == 0)
+		programs = 100;
+
+	int failures = 0;
+
+	for (const char* rom : roms)
+	{
+		chip8* c8 = new chip8();
+		chip8* reference = new chip8();
+		c8->setEngine(engine);
+		if (!c8->loadApplication(rom) || !reference->loadApplication(rom))
+		{
+			delete c8;
+			delete reference;
+			return -1;
+		}
+
+		uint64_t mismatch = diffMachines(*c8, *reference, cycles);
+		if (mismatch != 0)
+		{
+			printf("%s: MISMATCH before cycle %llu\n", rom, (unsigned long long)mismatch);
+			failures++;
+		}
+		else
+			printf("%s: identical for %llu cycles\n", rom, (unsigned long long)cycles);
+
+		delete c8;
+		delete reference;
+	}
+
+	uint32_t state = 0x8C1F;
+	for (int p = 0; p < programs; p++)
+	{
+		std::vector<uint8_t> program = randomProgram(state, 32 + nextRandom(state) % 480);
+
+		chip8* c8 = new chip8();
+		chip8* reference = new chip8();
+		c8->setEngine(engine);
+		c8->loadApplication(program.data(), program.size());
+		reference->loadApplication(program.data(), program.size());
+
+		uint64_t mismatch = diffMachines(*c8, *reference, cycles);
+		if (mismatch != 0)
+		{
+			printf("random program %d: MISMATCH before cycle %llu\n", p, (unsigned long long)mismatch);
+			failures++;
+		}
+
+		delete c8;
+		delete reference;
+	}
+
+	if (programs > 0)
+		printf("random programs: %d of %d identical for %llu cycles\n", programs - failures, programs, (unsigned long long)cycles);
+
+	return failures == 0 ? 0 : 2;
+}
+
+// Runs idle loops frame by frame at the given speed, once skipping them and once instruction by
+// instruction. Both have to be in the same state after every frame and most instructions have to
+// be skipped, even at the default speed where a frame is only a few turns of the loop.
+static int benchIdle(int argc, char** argv)
+{
+	uint32_t speed = SCHEDULER_DEFAULT_IPS;
+	uint64_t frames = 600;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			speed = (uint32_t)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			frames = strtoull(argv[++i], NULL, 10);
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	static const uint8_t timerPoll[] = { 0x60, 0xFF, 0xF0, 0x15, 0xF1, 0x07, 0x31, 0x00, 0x12, 0x04, 0x12, 0x02 };	// DT = 255, wait for it to reach 0, again
+	static const uint8_t jump[] = { 0x12, 0x00 };																	// Jump to itself
+	static const uint8_t keyWait[] = { 0xF0, 0x0A, 0x12, 0x00 };													// FX0A with no key pressed
+	static const struct { const char* Name; const uint8_t* Program; size_t Size; } programs[] =
+	{
+		{ "timer poll", timerPoll, sizeof(timerPoll) },
+		{ "jump", jump, sizeof(jump) },
+		{ "key wait", keyWait, sizeof(keyWait) },
+	};
+	static const struct { chip8Engine Engine; const char* Name; } engines[] =
+	{
+		{ chip8Engine::Interpreter, "interpreter" },
+		{ chip8Engine::BlockCache, "block" },
+		{ chip8Engine::Jit, "jit" },
+	};
+
+	printf("%llu frames at %u IPS\n", (unsigned long long)frames, speed);
+	printf("%-12s %-12s %12s %12s %8s %s\n", "program", "engine", "cycles", "skipped", "skipped%", "state");
+
+	int result = 0;
+	for (const auto& program : programs)
+	{
+		for (const auto& engine : engines)
+		{
+			chip8* c8 = new chip8();
+			chip8* reference = new chip8();
+			c8->setEngine(engine.Engine);
+			reference->setIdleSkip(false);
+			c8->loadApplication(program.Program, program.Size);
+			reference->loadApplication(program.Program, program.Size);
+			c8->seedRandom(1);
+			reference->seedRandom(1);
+
+			chip8Scheduler scheduler(*c8, speed);
+			chip8Scheduler referenceScheduler(*reference, speed);
+			bool same = true;
+			for (uint64_t f = 0; f < frames && same; f++)
+			{
+				scheduler.runFrame();
+				referenceScheduler.runFrame();
+				same = c8->sameState(*reference);
+			}
+
+			const uint64_t cycles = c8->getCycleCount();
+			const double skipped = cycles > 0 ? 100.0 * c8->getIdleCycles() / cycles : 0.0;
+			if (!same || skipped <= 50.0)
+				result = 2;
+
+			printf("%-12s %-12s %12llu %12llu %7.2f%% %s\n", program.Name, engine.Name, (unsigned long long)cycles,
+				(unsigned long long)c8->getIdleCycles(), skipped, !same ? "MISMATCH" : skipped <= 50.0 ? "NOT IDLE" : "ok");
+
+			delete c8;
+			delete reference;
+		}
+	}
+
+	return result;
+}
+
+// Result of running the same program on a batch and on separate machines
+struct BatchResult
+{
+	bool Same;
+	double BatchSeconds;
+	double SeparateSeconds;
+	uint64_t VectorSteps;
+	uint64_t SharedSteps;
+	uint64_t ScalarSteps;
+};
+
+// Runs lanes machines seeded 0, 1, 2... through a batch and a copy of each one on its own, ticking
+// the timers every 1000 cycles like diffMachines does
+static BatchResult batchMachines(const uint8_t* program, size_t size, int lanes, uint64_t cycles)
+{
+	std::vector<std::unique_ptr<chip8>> machines, references;
+	chip8Batch batch;
+
+	for (int l = 0; l < lanes; l++)
+	{
+		machines.push_back(std::unique_ptr<chip8>(new chip8()));
+		references.push_back(std::unique_ptr<chip8>(new chip8()));
+		machines[l]->loadApplication(program, size);
+		references[l]->loadApplication(program, size);
+		machines[l]->seedRandom(l);
+		references[l]->seedRandom(l);
+		batch.add(*machines[l]);
+	}
+
+	BatchResult result = { true, 0.0, 0.0, 0, 0, 0 };
+
+	for (uint64_t executed = 0; executed < cycles; executed += 1000)
+	{
+		const uint64_t n = cycles - executed < 1000 ? cycles - executed : 1000;
+
+		Clock::time_point start = Clock::now();
+		batch.run(n);
+		result.BatchSeconds += secondsSince(start);
+
+		start = Clock::now();
+		for (int l = 0; l < lanes; l++)
+			for (uint64_t i = 0; i < n; i++)
+				references[l]->emulateCycle();
+		result.SeparateSeconds += secondsSince(start);
+
+		for (int l = 0; l < lanes; l++)
+		{
+			result.Same = result.Same && machines[l]->sameState(*references[l]);
+			machines[l]->tickTimers();
+			references[l]->tickTimers();
+			machines[l]->setKeys(chunkKeys(executed / 1000, l));
+			references[l]->setKeys(chunkKeys(executed / 1000, l));
+		}
+	}
+
+	result.VectorSteps = batch.VectorSteps;
+	result.SharedSteps = batch.SharedSteps;
+	result.ScalarSteps = batch.ScalarSteps;
+	return result;
+}
+
+static int benchBatch(int argc, char** argv)
+{
+	std::vector<const char*> roms;
+	int lanes = BATCH_LANES;
+	uint64_t cycles = 1000000;
+	int programs = 0;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+			lanes = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			cycles = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			programs = atoi(argv[++i]);
+		else if (argv[i][0] != '-')
+			roms.push_back(argv[i]);
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (lanes < 1 || lanes > BATCH_LANES)
+	{
+		fprintf(stderr, "Lanes must be between 1 and %d\n", BATCH_LANES);
+		return 1;
+	}
+
+	if (roms.empty() && programs == 0)
+		programs = 100;
+
+	int failures = 0;
+
+	if (!roms.empty())
+		printf("%-32s %14s %14s %8s %7s %7s %7s %s\n", "ROM", "separate IPS", "batch IPS", "speedup", "vector", "shared", "scalar", "state");
+
+	for (const char* rom : roms)
+	{
+		std::vector<uint8_t> image = readRom(rom);
+		if (image.empty())
+		{
+			fprintf(stderr, "Could not read %s\n", rom);
+			return -1;
+		}
+
+		BatchResult r = batchMachines(image.data(), image.size(), lanes, cycles);
+		if (!r.Same)
+			failures++;
+
+		const double steps = (double)(r.VectorSteps + r.SharedSteps + r.ScalarSteps);
+		printf("%-32s %14.0f %14.0f %7.2fx %6.1f%% %6.1f%% %6.1f%% %s\n", rom, lanes * cycles / r.SeparateSeconds, lanes * cycles / r.BatchSeconds,
+			r.SeparateSeconds / r.BatchSeconds, 100.0 * r.VectorSteps / steps, 100.0 * r.SharedSteps / steps, 100.0 * r.ScalarSteps / steps,
+			r.Same ? "identical" : "MISMATCH");
+	}
+
+	uint32_t state = 0x8C1F;
+	int programFailures = 0;
+	for (int p = 0; p < programs; p++)
+	{
+		std::vector<uint8_t> program = randomProgram(state, 32 + nextRandom(state) % 480);
+
+		BatchResult r = batchMachines(program.data(), program.size(), lanes, cycles);
+		if (!r.Same)
+		{
+			printf("random program %d: MISMATCH\n", p);
+			programFailures++;
+		}
+	}
+
+	if (programs > 0)
+		printf("random programs: %d of %d identical for %llu cycles on %d lanes\n", programs - programFailures, programs, (unsigned long long)cycles, lanes);
+
+	return failures + programFailures == 0 ? 0 : 2;
+}
+
+// Plays every ROM for a while, then saves and restores it and checks that the copy keeps running
+// exactly like the original
+static int benchSnapshot(int argc, char** argv)
+{
+	std::vector<const char*> roms;
+	uint64_t cycles = 1000000;
+	int iterations = 10000;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			cycles = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			iterations = atoi(argv[++i]);
+		else if (argv[i][0] != '-')
+			roms.push_back(argv[i]);
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (roms.empty() || iterations <= 0)
+	{
+		printUsage();
+		return 1;
+	}
+
+	printf("%-32s %6s %8s %11s %11s %s\n", "ROM", "mode", "bytes", "save us", "restore us", "state");
+
+	int result = 0;
+	for (const char* rom : roms)
+	{
+		std::vector<uint8_t> image = readRom(rom);
+		if (image.empty())
+		{
+			fprintf(stderr, "Could not read %s\n", rom);
+			return -1;
+		}
+
+		chip8 original;
+		original.loadApplication(image.data(), image.size());
+		original.seedRandom(1);
+		for (uint64_t executed = 0; executed < cycles; executed += 1000)
+		{
+			original.run(1000);
+			original.DrawFlag = false;
+			original.tickTimers();
+		}
+
+		for (int delta = 1; delta >= 0; delta--)
+		{
+			std::vector<uint8_t> state;
+
+			Clock::time_point start = Clock::now();
+			for (int n = 0; n < iterations; n++)
+				original.snapshot(state, delta != 0);
+			const double saveSeconds = secondsSince(start);
+
+			chip8 copy;
+			copy.loadApplication(image.data(), image.size());
+
+			start = Clock::now();
+			bool restored = true;
+			for (int n = 0; n < iterations; n++)
+				restored = restored && copy.restore(state.data(), state.size());
+			const double restoreSeconds = secondsSince(start);
+
+			// Both have to keep going the same way, including the random numbers
+			bool same = restored && copy.sameState(original);
+			chip8 reference;
+			reference.loadApplication(image.data(), image.size());
+			same = same && reference.restore(state.data(), state.size());
+			for (int n = 0; n < 100 && same; n++)
+			{
+				reference.run(1000);
+				copy.run(1000);
+				same = copy.sameState(reference);
+			}
+			if (!same)
+				result = 2;
+
+			printf("%-32s %6s %8zu %11.3f %11.3f %s\n", rom, delta ? "delta" : "full", state.size(),
+				saveSeconds * 1e6 / iterations, restoreSeconds * 1e6 / iterations, same ? "identical" : "MISMATCH");
+		}
+	}
+
+	return result;
+}
+
+// Runs an instruction count on a machine, ignoring draws
+static void runCycles(chip8& c8, uint64_t cycles)
+{
+	uint64_t executed = 0;
+	while (executed < cycles)
+	{
+		executed += c8.run(cycles - executed);
+		c8.DrawFlag = false;
+	}
+}
+
+// Forks a machine over and over the way a search does, with copy-on-write pages and with a full
+// copy of the state through a save state for comparison
+static int benchFork(int argc, char** argv)
+{
+	std::vector<const char*> roms;
+	uint64_t cycles = 100000;
+	int forks = 100000;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			cycles = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			forks = atoi(argv[++i]);
+		else if (argv[i][0] != '-')
+			roms.push_back(argv[i]);
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (roms.empty() || forks <= 0)
+	{
+		printUsage();
+		return 1;
+	}
+
+	printf("%-32s %-6s %14s %14s %12s %s\n", "ROM", "copy", "forks/s", "fork+run/s", "pages copied", "state");
+
+	int result = 0;
+	for (const char* rom : roms)
+	{
+		std::vector<uint8_t> image = readRom(rom);
+		if (image.empty())
+		{
+			fprintf(stderr, "Could not read %s\n", rom);
+			return -1;
+		}
+
+		chip8 parent;
+		parent.loadApplication(image.data(), image.size());
+		parent.seedRandom(1);
+		runCycles(parent, cycles);
+
+		std::vector<uint8_t> before;
+		parent.snapshot(before, false);
+
+		chip8 cow, full;
+		cow.loadApplication(image.data(), image.size());
+		full.loadApplication(image.data(), image.size());
+
+		// Fork alone
+		Clock::time_point start = Clock::now();
+		for (int n = 0; n < forks; n++)
+			cow.forkFrom(parent);
+		const double cowForkSeconds = secondsSince(start);
+
+		start = Clock::now();
+		for (int n = 0; n < forks; n++)
+			full.restore(before.data(), before.size());
+		const double fullForkSeconds = secondsSince(start);
+
+		// Fork and run a little, which is where the pages get copied
+		uint64_t copied = 0;
+		start = Clock::now();
+		for (int n = 0; n < forks; n++)
+		{
+			cow.forkFrom(parent);
+			runCycles(cow, 100);
+			copied += MEMORY_PAGES - cow.sharedPages();
+		}
+		const double cowRunSeconds = secondsSince(start);
+
+		start = Clock::now();
+		for (int n = 0; n < forks; n++)
+		{
+			full.restore(before.data(), before.size());
+			runCycles(full, 100);
+		}
+		const double fullRunSeconds = secondsSince(start);
+
+		// The forks end up the same and the parent never sees their writes
+		std::vector<uint8_t> after;
+		parent.snapshot(after, false);
+		const bool same = cow.sameState(full) && after == before;
+		if (!same)
+			result = 2;
+
+		printf("%-32s %-6s %14.0f %14.0f %12.2f %s\n", rom, "cow", forks / cowForkSeconds, forks / cowRunSeconds, (double)copied / forks, same ? "identical" : "MISMATCH");
+		printf("%-32s %-6s %14.0f %14.0f %12d %s\n", rom, "full", forks / fullForkSeconds, forks / fullRunSeconds, MEMORY_PAGES, same ? "identical" : "MISMATCH");
+	}
+
+	return result;
+}
+
+
+// Starts machines on ROMs the way a farm does, mapping and copying the file every time compared
+// with the ROM index, which shares the pages of the image it loaded the first time
+static int benchLoad(int argc, char** argv)
+{
+	std::vector<const char*> roms;
+	int loads = 10000;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			loads = atoi(argv[++i]);
+		else if (argv[i][0] != '-')
+			roms.push_back(argv[i]);
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (roms.empty() || loads <= 0)
+	{
+		printUsage();
+		return 1;
+	}
+
+	printf("%-32s %6s %16s %8s %14s %14s %s\n", "ROM", "size", "hash", "variant", "file loads/s", "index loads/s", "state");
+
+	chip8RomIndex index;
+	int result = 0;
+	for (const char* rom : roms)
+	{
+		const chip8RomInfo* info = index.find(rom);
+		if (info == NULL)
+			return -1;
+
+		Clock::time_point start = Clock::now();
+		for (int n = 0; n < loads; n++)
+		{
+			chip8 c8;
+			chip8RomFile file;
+			if (!file.open(rom) || !c8.loadApplication(file.data(), file.size()))
+				return -1;
+		}
+		const double fileSeconds = secondsSince(start);
+
+		start = Clock::now();
+		for (int n = 0; n < loads; n++)
+		{
+			chip8 c8;
+			if (!index.load(c8, rom))
+				return -1;
+		}
+		const double indexSeconds = secondsSince(start);
+
+		// Both ways give the same machine
+		chip8 fromFile, fromIndex;
+		chip8RomFile file;
+		file.open(rom);
+		fromFile.loadApplication(file.data(), file.size());
+		index.load(fromIndex, rom);
+		fromIndex.setRandomState(fromFile.getRandomState());
+		runCycles(fromFile, 10000);
+		runCycles(fromIndex, 10000);
+		const bool same = fromFile.sameState(fromIndex);
+		if (!same)
+			result = 2;
+
+		printf("%-32s %6zu %016llx %8s %14.0f %14.0f %s\n", rom, info->Size, (unsigned long long)info->Hash, chip8RomIndex::variantName(info->Variant),
+			loads / fileSeconds, loads / indexSeconds, same ? "identical" : "MISMATCH");
+	}
+
+	return result;
+}
+
+// Plays a ROM for a while pushing every frame to a rewind history, then goes back a second at a
+// time checking every state it lands on against the full save state taken at that frame
+static int benchRewind(int argc, char** argv)
+{
+	std::vector<const char*> roms;
+	int frames = 3600;
+	uint64_t cycles = 10; // 600 instructions per second
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			cycles = strtoull(argv[++i], NULL, 10);
+		else if (argv[i][0] != '-')
+			roms.push_back(argv[i]);
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (roms.empty() || frames <= 0)
+	{
+		printUsage();
+		return 1;
+	}
+
+	printf("%-32s %8s %10s %10s %12s %12s %s\n", "ROM", "frames", "state", "bytes/fr", "push us", "rewind 60us", "state");
+
+	int result = 0;
+	for (const char* rom : roms)
+	{
+		std::vector<uint8_t> image = readRom(rom);
+		if (image.empty())
+		{
+			fprintf(stderr, "Could not read %s\n", rom);
+			return -1;
+		}
+
+		chip8 c8;
+		c8.loadApplication(image.data(), image.size());
+		c8.seedRandom(1);
+
+		// Big enough for every frame so all of them can be checked
+		chip8Rewind history(64 << 20);
+		std::vector<std::vector<uint8_t>> states(frames);
+
+		double pushSeconds = 0;
+		for (int f = 0; f < frames; f++)
+		{
+			runCycles(c8, cycles);
+			c8.tickTimers();
+			c8.snapshot(states[f], false);
+
+			Clock::time_point start = Clock::now();
+			history.push(c8);
+			pushSeconds += secondsSince(start);
+		}
+		const double bytesPerFrame = (double)history.bytes() / frames;
+
+		bool same = true;
+		int rewinds = 0;
+		double rewindSeconds = 0;
+		int at = frames - 1;
+		while (history.frames() > 60)
+		{
+			Clock::time_point start = Clock::now();
+			const int back = history.rewind(c8, 60);
+			rewindSeconds += secondsSince(start);
+			rewinds++;
+
+			at -= back;
+			std::vector<uint8_t> state;
+			c8.snapshot(state, false);
+			same = same && back == 60 && state == states[at];
+		}
+		if (!same)
+			result = 2;
+
+		printf("%-32s %8d %10zu %10.1f %12.2f %12.2f %s\n", rom, frames, states[0].size(), bytesPerFrame,
+			pushSeconds * 1e6 / frames, rewinds > 0 ? rewindSeconds * 1e6 / rewinds : 0.0, same ? "identical" : "MISMATCH");
+	}
+
+	return result;
+}
+
+#define GFX_WORDS (GFX_HEIGHT * GFX_ROW_WORDS)
+
+static void randomRows(uint32_t& state, uint64_t* rows)
+{
+	for (int w = 0; w < GFX_WORDS; w++)
+		rows[w] = (uint64_t)nextRandom(state) << 32 | nextRandom(state);
+}
+
+// Compares a set of kernels with the scalar ones on random framebuffers
+static bool checkKernels(const chip8GfxKernels& kernels, const chip8GfxKernels& reference)
+{
+	uint32_t state = 0x6F1;
+	uint64_t a[GFX_WORDS], b[GFX_WORDS], expected[GFX_WORDS];
+
+	for (int n = 0; n < 10000; n++)
+	{
+		randomRows(state, a);
+		memcpy(expected, a, sizeof(a));
+
+		uint8_t sprite[16];
+		for (int r = 0; r < 16; r++)
+			sprite[r] = (uint8_t)nextRandom(state);
+
+		const int x = nextRandom(state) % GFX_WIDTH;
+		const int y = nextRandom(state) % GFX_HEIGHT;
+		const int height = 1 + nextRandom(state) % 15;
+		if (kernels.Blit(a, x, y, sprite, height) != reference.Blit(expected, x, y, sprite, height) || memcmp(a, expected, sizeof(a)) != 0)
+			return false;
+
+		// Same picture with a few rows changed
+		memcpy(b, a, sizeof(a));
+		for (int changes = nextRandom(state) % 4; changes > 0; changes--)
+			b[nextRandom(state) % GFX_WORDS] ^= 1ULL << (nextRandom(state) % 64);
+		if (kernels.Equal(a, b) != reference.Equal(a, b) || kernels.DiffRows(a, b) != reference.DiffRows(a, b))
+			return false;
+
+		const int rows = nextRandom(state) % (GFX_HEIGHT + 4);
+		const int pixels = nextRandom(state) % (GFX_WIDTH + 8);
+		kernels.ScrollDown(a, rows);
+		reference.ScrollDown(expected, rows);
+		kernels.ScrollLeft(a, pixels);
+		reference.ScrollLeft(expected, pixels);
+		kernels.ScrollRight(a, pixels / 2);
+		reference.ScrollRight(expected, pixels / 2);
+		if (memcmp(a, expected, sizeof(a)) != 0)
+			return false;
+
+		kernels.Clear(a);
+		reference.Clear(expected);
+		if (memcmp(a, expected, sizeof(a)) != 0)
+			return false;
+	}
+
+	return true;
+}
+
+// Nanoseconds per call of one kernel, op runs the call for iteration n
+template<typename Op>
+static double timeKernel(uint64_t iterations, Op op)
+{
+	Clock::time_point start = Clock::now();
+	for (uint64_t n = 0; n < iterations; n++)
+		op(n);
+
+	return secondsSince(start) * 1e9 / iterations;
+}
+
+static int benchGfx(int argc, char** argv)
+{
+	uint64_t iterations = 5000000;
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			iterations = strtoull(argv[++i], NULL, 10);
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	static const chip8Simd levels[] = { chip8Simd::Scalar, chip8Simd::SSE2, chip8Simd::AVX2 };
+	const chip8GfxKernels* kernels[3];
+	const chip8GfxKernels* reference = gfxKernels(chip8Simd::Scalar);
+	int result = 0;
+
+	printf("Active kernels: %s\n", gfxActiveKernels().Name);
+	for (int l = 0; l < 3; l++)
+	{
+		kernels[l] = gfxKernels(levels[l]);
+		if (kernels[l] != NULL && l > 0)
+		{
+			bool same = checkKernels(*kernels[l], *reference);
+			if (!same)
+				result = 2;
+			printf("%s: %s\n", kernels[l]->Name, same ? "identical to scalar" : "MISMATCH");
+		}
+	}
+
+	// Precomputed sprite positions so the loops only measure the kernels
+	uint32_t state = 0xB17;
+	int positions[256][2];
+	for (int p = 0; p < 256; p++)
+	{
+		positions[p][0] = nextRandom(state) % GFX_WIDTH;
+		positions[p][1] = nextRandom(state) % (GFX_HEIGHT - 15);
+	}
+
+	uint64_t a[GFX_WORDS], b[GFX_WORDS];
+	uint8_t sprite[16];
+	randomRows(state, a);
+	memcpy(b, a, sizeof(a));
+	memcpy(sprite, a, sizeof(sprite));
+	volatile uint64_t sink = 0;
+
+	printf("\n%-20s", "ns per call");
+	for (int l = 0; l < 3; l++)
+		if (kernels[l] != NULL)
+			printf(" %10s", kernels[l]->Name);
+	printf("\n");
+
+	static const char* names[] = { "clear", "blit (15 rows)", "equal", "diffRows", "scrollDown", "scrollLeft", "scrollRight" };
+	for (int k = 0; k < 7; k++)
+	{
+		printf("%-20s", names[k]);
+		for (int l = 0; l < 3; l++)
+		{
+			const chip8GfxKernels* K = kernels[l];
+			if (K == NULL)
+				continue;
+
+			double ns = 0.0;
+			switch (k)
+			{
+				case 0: ns = timeKernel(iterations, [&](uint64_t) { K->Clear(a); }); break;
+				case 1: ns = timeKernel(iterations, [&](uint64_t n) { sink += K->Blit(a, positions[n & 255][0], positions[n & 255][1], sprite, 15); }); break;
+				case 2: ns = timeKernel(iterations, [&](uint64_t) { sink += K->Equal(a, b); }); break;
+				case 3: ns = timeKernel(iterations, [&](uint64_t) { sink += K->DiffRows(a, b); }); break;
+				case 4: ns = timeKernel(iterations, [&](uint64_t) { K->ScrollDown(a, 4); }); break;
+				case 5: ns = timeKernel(iterations, [&](uint64_t) { K->ScrollLeft(a, 4); }); break;
+				default: ns = timeKernel(iterations, [&](uint64_t) { K->ScrollRight(a, 4); }); break;
+			}
+			printf(" %10.2f", ns);
+		}
+		printf("\n");
+	}
+
+	return result;
+}
+
+// Runs the same set of machines with more and more worker threads and shows how the throughput scales
+static int benchHost(int argc, char** argv)
+{
+	const char* rom = NULL;
+	int machines = 256;
+	uint64_t frames = 60;
+	uint32_t speed = 600000;
+	chip8Engine engine = chip8Engine::Interpreter;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+			machines = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			frames = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			speed = (uint32_t)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc && parseEngine(argv[i + 1], engine))
+			i++;
+		else if (argv[i][0] != '-' && rom == NULL)
+			rom = argv[i];
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (rom == NULL || machines <= 0 || frames == 0)
+	{
+		printUsage();
+		return 1;
+	}
+
+	// Every machine shares the pages of the ROM's image until it writes to them
+	chip8RomIndex index;
+	const chip8RomInfo* image = index.find(rom);
+	if (image == NULL)
+		return -1;
+
+	// 1, 2, 4... and the whole machine
+	std::vector<unsigned> counts;
+	unsigned hardware = std::thread::hardware_concurrency();
+	if (hardware == 0)
+		hardware = 1;
+	for (unsigned t = 1; t < hardware; t *= 2)
+		counts.push_back(t);
+	counts.push_back(hardware);
+
+	printf("%d machines, %llu frames at %u IPS each\n", machines, (unsigned long long)frames, speed);
+	printf("%8s %14s %8s %10s %10s %8s\n", "threads", "IPS", "speedup", "efficiency", "slices", "steals");
+
+	double single = 0.0;
+	for (unsigned threads : counts)
+	{
+		chip8Host host(threads, speed);
+		for (int m = 0; m < machines; m++)
+			if (host.add(*image, engine) < 0)
+				return -1;
+
+		Clock::time_point start = Clock::now();
+		uint64_t cycles = host.runFrames(frames);
+		double ips = cycles / secondsSince(start);
+		if (threads == 1)
+			single = ips;
+
+		printf("%8u %14.0f %7.2fx %9.0f%% %10llu %8llu\n", threads, ips, ips / single, 100.0 * ips / single / threads,
+			(unsigned long long)host.Slices, (unsigned long long)host.Steals);
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		printUsage();
+		return 1;
+	}
+
+	if (strcmp(argv[1], "dispatch") == 0)
+		return benchDispatch(argc, argv);
+	if (strcmp(argv[1], "engines") == 0)
+		return benchEngines(argc, argv);
+	if (strcmp(argv[1], "diff") == 0)
+		return benchDiff(argc, argv);
+	if (strcmp(argv[1], "idle") == 0)
+		return benchIdle(argc, argv);
+	if (strcmp(argv[1], "batch") == 0)
+		return benchBatch(argc, argv);
+	if (strcmp(argv[1], "snapshot") == 0)
+		return benchSnapshot(argc, argv);
+	if (strcmp(argv[1], "fork") == 0)
+		return benchFork(argc, argv);
+	if (strcmp(argv[1], "rewind") == 0)
+		return benchRewind(argc, argv);
+	if (strcmp(argv[1], "load") == 0)
+		return benchLoad(argc, argv);
+	if (strcmp(argv[1], "gfx") == 0)
+		return benchGfx(argc, argv);
+	if (strcmp(argv[1], "host") == 0)
+		return benchHost(argc, argv);
+
+	printUsage();
+	return 1;
+}
@@ -0,0 +1,414 @@
+#include "batch.h"
+#include "gfxsimd.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BATCH_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define BATCH_SIMD_X86 0
+#endif
+
+// GCC and Clang only emit AVX2 instructions in functions that ask for them, MSVC always does
+#if defined(_MSC_VER) && !defined(__clang__)
+#define BATCH_TARGET_AVX2
+#else
+#define BATCH_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static_assert(BATCH_LANES == 32, "The kernels keep one register of every lane in a 32 byte vector");
+
+// Instructions the kernels execute, they only work on V and I and always continue at PC + 2 or PC + 4
+static bool laneOp(uint8_t op)
+{
+	switch (op)
+	{
+		case OP_3XNN: case OP_4XNN: case OP_5XY0: case OP_9XY0:
+		case OP_6XNN: case OP_7XNN:
+		case OP_8XY0: case OP_8XY1: case OP_8XY2: case OP_8XY3:
+		case OP_8XY4: case OP_8XY5: case OP_8XY6: case OP_8XY7: case OP_8XYE:
+		case OP_ANNN: case OP_FX1E:
+			return true;
+		default:
+			return false;
+	}
+}
+
+static bool skipOp(uint8_t op)
+{
+	return op == OP_3XNN || op == OP_4XNN || op == OP_5XY0 || op == OP_9XY0;
+}
+
+// Registers the handler of any other instruction may read or write, copied to and from the machines
+static uint16_t touchedRegisters(const chip8Instruction& in)
+{
+	uint16_t registers = (uint16_t)(1 << in.X | 1 << in.Y | 1 << 0xF | 1 << 0); // BNNN reads V0
+	if (in.Op == OP_FX55 || in.Op == OP_FX65)
+		registers |= (uint16_t)((2 << in.X) - 1);
+
+	return registers;
+}
+
+// Scalar kernel, a loop over the lanes doing exactly what the handlers in chip8.cpp do.
+// VF is written before VX is, just like the handlers, so 8FY4 and friends give the same result.
+static uint32_t laneKernelScalar(chip8BatchRegisters& r, const chip8Instruction& in)
+{
+	uint8_t* vx = r.V[in.X];
+	uint8_t* vy = r.V[in.Y];
+	uint8_t* vf = r.V[0xF];
+	uint32_t skip = 0;
+
+	for (int l = 0; l < BATCH_LANES; l++)
+	{
+		switch (in.Op)
+		{
+			case OP_3XNN: skip |= (uint32_t)(vx[l] == in.NN) << l; break;
+			case OP_4XNN: skip |= (uint32_t)(vx[l] != in.NN) << l; break;
+			case OP_5XY0: skip |= (uint32_t)(vx[l] == vy[l]) << l; break;
+			case OP_9XY0: skip |= (uint32_t)(vx[l] != vy[l]) << l; break;
+			case OP_6XNN: vx[l] = in.NN; break;
+			case OP_7XNN: vx[l] += in.NN; break;
+			case OP_8XY0: vx[l] = vy[l]; break;
+			case OP_8XY1: vx[l] |= vy[l]; break;
+			case OP_8XY2: vx[l] &= vy[l]; break;
+			case OP_8XY3: vx[l] ^= vy[l]; break;
+			case OP_8XY4: vf[l] = vy[l] > 0xFF - vx[l]; vx[l] += vy[l]; break;
+			case OP_8XY5: vf[l] = vy[l] <= vx[l]; vx[l] -= vy[l]; break;
+			case OP_8XY6: vf[l] = vx[l] & 0x01; vx[l] >>= 1; break;
+			case OP_8XY7: vf[l] = vx[l] <= vy[l]; vx[l] = vy[l] - vx[l]; break;
+			case OP_8XYE: vf[l] = vx[l] >> 7; vx[l] <<= 1; break;
+			case OP_ANNN: r.I[l] = in.NNN; break;
+			case OP_FX1E: vf[l] = r.I[l] + vx[l] > 0x0FFF; r.I[l] += vx[l]; break;
+		}
+	}
+
+	return skip;
+}
+
+#if BATCH_SIMD_X86
+
+// AVX2 kernel, one register of all 32 lanes per vector. Every operand is loaded again after VF is
+// stored because X or Y may be F.
+BATCH_TARGET_AVX2 static uint32_t laneKernelAVX2(chip8BatchRegisters& r, const chip8Instruction& in)
+{
+	__m256i* vx = (__m256i*)r.V[in.X];
+	__m256i* vy = (__m256i*)r.V[in.Y];
+	__m256i* vf = (__m256i*)r.V[0xF];
+	const __m256i one = _mm256_set1_epi8(1);
+
+	switch (in.Op)
+	{
+		case OP_3XNN: return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256(vx), _mm256_set1_epi8((char)in.NN)));
+		case OP_4XNN: return ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256(vx), _mm256_set1_epi8((char)in.NN)));
+		case OP_5XY0: return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256(vx), _mm256_load_si256(vy)));
+		case OP_9XY0: return ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_load_si256(vx), _mm256_load_si256(vy)));
+
+		case OP_6XNN: _mm256_store_si256(vx, _mm256_set1_epi8((char)in.NN)); break;
+		case OP_7XNN: _mm256_store_si256(vx, _mm256_add_epi8(_mm256_load_si256(vx), _mm256_set1_epi8((char)in.NN))); break;
+		case OP_8XY0: _mm256_store_si256(vx, _mm256_load_si256(vy)); break;
+		case OP_8XY1: _mm256_store_si256(vx, _mm256_or_si256(_mm256_load_si256(vx), _mm256_load_si256(vy))); break;
+		case OP_8XY2: _mm256_store_si256(vx, _mm256_and_si256(_mm256_load_si256(vx), _mm256_load_si256(vy))); break;
+		case OP_8XY3: _mm256_store_si256(vx, _mm256_xor_si256(_mm256_load_si256(vx), _mm256_load_si256(vy))); break;
+
+		case OP_8XY4:
+		{
+			// Carry when the wrapped sum is smaller than VX
+			const __m256i a = _mm256_load_si256(vx);
+			const __m256i sum = _mm256_add_epi8(a, _mm256_load_si256(vy));
+			_mm256_store_si256(vf, _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(sum, a), sum), one));
+			_mm256_store_si256(vx, _mm256_add_epi8(_mm256_load_si256(vx), _mm256_load_si256(vy)));
+			break;
+		}
+		case OP_8XY5:
+		{
+			// No borrow when VX >= VY
+			const __m256i a = _mm256_load_si256(vx);
+			_mm256_store_si256(vf, _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, _mm256_load_si256(vy)), a), one));
+			_mm256_store_si256(vx, _mm256_sub_epi8(_mm256_load_si256(vx), _mm256_load_si256(vy)));
+			break;
+		}
+		case OP_8XY6:
+			_mm256_store_si256(vf, _mm256_and_si256(_mm256_load_si256(vx), one));
+			_mm256_store_si256(vx, _mm256_and_si256(_mm256_srli_epi16(_mm256_load_si256(vx), 1), _mm256_set1_epi8(0x7F)));
+			break;
+		case OP_8XY7:
+		{
+			// No borrow when VY >= VX
+			const __m256i b = _mm256_load_si256(vy);
+			_mm256_store_si256(vf, _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(_mm256_load_si256(vx), b), b), one));
+			_mm256_store_si256(vx, _mm256_sub_epi8(_mm256_load_si256(vy), _mm256_load_si256(vx)));
+			break;
+		}
+		case OP_8XYE:
+			_mm256_store_si256(vf, _mm256_and_si256(_mm256_srli_epi16(_mm256_load_si256(vx), 7), one));
+			_mm256_store_si256(vx, _mm256_add_epi8(_mm256_load_si256(vx), _mm256_load_si256(vx)));
+			break;
+
+		case OP_ANNN:
+			_mm256_store_si256((__m256i*)r.I, _mm256_set1_epi16((short)in.NNN));
+			_mm256_store_si256((__m256i*)r.I + 1, _mm256_set1_epi16((short)in.NNN));
+			break;
+
+		case OP_FX1E:
+		{
+			// VF = I + VX > 0xFFF, the sum is done in 16 bits so a carry out of them counts as well
+			const __m256i limit = _mm256_set1_epi16(0x0FFF);
+			__m256i flags[2];
+			for (int h = 0; h < 2; h++)
+			{
+				const __m256i i = _mm256_load_si256((__m256i*)r.I + h);
+				const __m256i sum = _mm256_add_epi16(i, _mm256_cvtepu8_epi16(_mm_load_si128((__m128i*)r.V[in.X] + h)));
+				const __m256i inRange = _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_min_epu16(sum, limit), sum), _mm256_cmpeq_epi16(_mm256_max_epu16(sum, i), sum));
+				flags[h] = _mm256_andnot_si256(inRange, _mm256_set1_epi16(1));
+			}
+			// packus interleaves the 128 bit halves, put the lanes back in order
+			_mm256_store_si256(vf, _mm256_permute4x64_epi64(_mm256_packus_epi16(flags[0], flags[1]), 0xD8));
+
+			for (int h = 0; h < 2; h++)
+			{
+				const __m256i i = _mm256_load_si256((__m256i*)r.I + h);
+				_mm256_store_si256((__m256i*)r.I + h, _mm256_add_epi16(i, _mm256_cvtepu8_epi16(_mm_load_si128((__m128i*)r.V[in.X] + h))));
+			}
+			break;
+		}
+	}
+
+	return 0;
+}
+
+#endif
+
+chip8Batch::chip8Batch()
+{
+	memset(Machines, 0, sizeof(Machines));
+	memset(&Regs, 0, sizeof(Regs));
+	Lanes = 0;
+	LaneMask = 0;
+	PC = 0;
+	Gathered = false;
+	Pending = 0;
+	LastOpcode = 0;
+	OpcodeStale = false;
+	memset(SameCode, 0, sizeof(SameCode));
+
+	VectorSteps = 0;
+	SharedSteps = 0;
+	ScalarSteps = 0;
+
+	Kernel = laneKernelScalar;
+#if BATCH_SIMD_X86
+	if (gfxBestSimd() == chip8Simd::AVX2)
+		Kernel = laneKernelAVX2;
+#endif
+}
+
+bool chip8Batch::add(chip8& machine)
+{
+	if (Lanes == BATCH_LANES)
+		return false;
+
+	Machines[Lanes] = &machine;
+	LaneMask |= 1u << Lanes;
+	Lanes++;
+	return true;
+}
+
+bool chip8Batch::converged() const
+{
+	for (int l = 1; l < Lanes; l++)
+		if (Machines[l]->PC != Machines[0]->PC)
+			return false;
+
+	return true;
+}
+
+void chip8Batch::gather()
+{
+	for (int l = 0; l < Lanes; l++)
+	{
+		const chip8& m = *Machines[l];
+		for (int r = 0; r < 16; r++)
+			Regs.V[r][l] = m.V[r];
+		Regs.I[l] = m.I;
+	}
+
+	PC = Machines[0]->PC;
+	Pending = 0;
+	OpcodeStale = false;
+	Gathered = true;
+
+	// Memory may have changed since the lanes were last together
+	memset(SameCode, 0, sizeof(SameCode));
+}
+
+bool chip8Batch::sameOpcode(uint16_t pc)
+{
+	// Memory only changes through the lanes' machines, checking every address once per gather and
+	// store is enough
+	pc &= 0x0FFF;
+	if (SameCode[pc / 64] >> (pc % 64) & 1)
+		return true;
+
+	const uint8_t hi = Machines[0]->Memory[pc];
+	const uint8_t lo = Machines[0]->Memory[(pc + 1) & 0x0FFF];
+	for (int l = 1; l < Lanes; l++)
+		if (Machines[l]->Memory[pc] != hi || Machines[l]->Memory[(pc + 1) & 0x0FFF] != lo)
+			return false;
+
+	SameCode[pc / 64] |= 1ULL << (pc % 64);
+	return true;
+}
+
+void chip8Batch::release(uint16_t registers, bool stepped)
+{
+	// Hand the lanes back to their machines, registers says which V still have to be copied
+	for (int l = 0; l < Lanes; l++)
+	{
+		chip8& m = *Machines[l];
+		for (int r = 0; r < 16; r++)
+			if (registers >> r & 1)
+				m.V[r] = Regs.V[r][l];
+
+		if (!stepped)
+		{
+			m.I = Regs.I[l];
+			m.PC = PC;
+			if (OpcodeStale)
+				m.OPCode = LastOpcode;
+		}
+		m.CycleCount += Pending;
+	}
+
+	Pending = 0;
+	OpcodeStale = false;
+	Gathered = false;
+}
+
+void chip8Batch::stepShared(const chip8Instruction& in)
+{
+	// Only the registers the instruction can touch go over, the rest stay in Regs
+	const uint16_t registers = touchedRegisters(in);
+	uint8_t list[16];
+	int count = 0;
+	for (int r = 0; r < 16; r++)
+		if (registers >> r & 1)
+			list[count++] = (uint8_t)r;
+
+	for (int l = 0; l < Lanes; l++)
+	{
+		chip8& m = *Machines[l];
+		for (int n = 0; n < count; n++)
+			m.V[list[n]] = Regs.V[list[n]][l];
+		m.I = Regs.I[l];
+		m.PC = PC;
+
+		m.emulateCycle();
+	}
+
+	SharedSteps++;
+
+	if (in.Flags & INSTR_STORE)
+		memset(SameCode, 0, sizeof(SameCode));
+
+	// BNNN, a skip on a key or a wait for one can send the lanes different ways. The machines
+	// already went on from PC, they keep their own PC and I.
+	if (!converged())
+	{
+		release((uint16_t)~registers, true);
+		return;
+	}
+
+	for (int l = 0; l < Lanes; l++)
+	{
+		const chip8& m = *Machines[l];
+		for (int n = 0; n < count; n++)
+			Regs.V[list[n]][l] = m.V[list[n]];
+		Regs.I[l] = m.I;
+	}
+
+	PC = Machines[0]->PC;
+	OpcodeStale = false;
+}
+
+void chip8Batch::stepScalar()
+{
+	for (int l = 0; l < Lanes; l++)
+		Machines[l]->emulateCycle();
+
+	ScalarSteps++;
+}
+
+uint64_t chip8Batch::run(uint64_t cycles)
+{
+	if (Lanes == 0)
+		return 0;
+
+	const chip8Instruction* table = chip8::decodeTable();
+
+	for (uint64_t n = 0; n < cycles; n++)
+	{
+		// Traced builds record every instruction through emulateCycle
+		if (!Gathered && !Trace::Enabled && converged())
+			gather();
+
+		if (!Gathered)
+		{
+			stepScalar();
+			continue;
+		}
+
+		// Every lane has to be about to run the same opcode, code can differ after FX55
+		if (!sameOpcode(PC))
+		{
+			release(0xFFFF);
+			stepScalar();
+			continue;
+		}
+
+		const uint16_t opcode = (uint16_t)(Machines[0]->Memory[PC & 0x0FFF] << 8 | Machines[0]->Memory[(PC + 1) & 0x0FFF]);
+		const chip8Instruction& in = table[opcode];
+
+		if (in.Op == OP_1NNN)
+		{
+			PC = in.NNN;
+		}
+		else if (laneOp(in.Op))
+		{
+			const uint32_t skip = Kernel(Regs, in) & LaneMask;
+
+			if (!skipOp(in.Op) || skip == 0)
+				PC += 2;
+			else if (skip == LaneMask)
+				PC += 4;
+			else
+			{
+				// The lanes split up here, each one continues on its own machine
+				Pending++;
+				LastOpcode = opcode;
+				OpcodeStale = true;
+				VectorSteps++;
+				release(0xFFFF);
+
+				for (int l = 0; l < Lanes; l++)
+					Machines[l]->PC += (skip >> l & 1) ? 4 : 2;
+				continue;
+			}
+		}
+		else
+		{
+			stepShared(in);
+			continue;
+		}
+
+		Pending++;
+		LastOpcode = opcode;
+		OpcodeStale = true;
+		VectorSteps++;
+	}
+
+	// The machines are the ones callers look at
+	if (Gathered)
+		release(0xFFFF);
+
+	return cycles * Lanes;
+}
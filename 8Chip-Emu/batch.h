@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include "chip8.h"
+
+// Runs up to BATCH_LANES machines in lockstep (structure of arrays)
+// Populations of machines running the same ROM with different seeds or inputs spend most of their
+// time at the same PC. While every lane is at the same PC with the same opcode the batch keeps the
+// V registers and I of all lanes side by side, V0 of every lane in one row, V1 in the next... so a
+// single AVX2 instruction does the register work of 32 machines. Anything else (draws, memory,
+// keys, timers, the stack) runs on every lane's own machine with just the registers it needs copied
+// over. Once the lanes end up at different PCs every machine steps on its own with emulateCycle,
+// and they go back to lockstep as soon as their PCs meet again.
+// The lanes always end up in exactly the state the interpreter would leave them in.
+
+#define BATCH_LANES 32
+
+// Registers of every lane, row r of V holds Vr of all the lanes
+struct chip8BatchRegisters
+{
+	alignas(32) uint8_t V[16][BATCH_LANES];
+	alignas(32) uint16_t I[BATCH_LANES];
+};
+
+class chip8Batch
+{
+	public:
+		chip8Batch();
+
+		// Add a machine as the next lane, false when the batch is full.
+		// The machine keeps working on its own between runs.
+		bool add(chip8& machine);
+		int lanes() const { return Lanes; }
+
+		// Execute cycles instructions on every lane. Unlike chip8::run it doesn't stop at draws, the
+		// lanes' DrawFlag is left set. Returns the instructions executed by all the lanes together.
+		uint64_t run(uint64_t cycles);
+
+		uint64_t VectorSteps;	// Instructions executed for all lanes at once with vector code
+		uint64_t SharedSteps;	// Instructions all lanes executed together through their own machines
+		uint64_t ScalarSteps;	// Steps where the lanes were at different PCs
+
+	private:
+		chip8* Machines[BATCH_LANES];
+		int Lanes;
+		uint32_t LaneMask;			// Bit n is set for every lane in use
+
+		chip8BatchRegisters Regs;	// Only up to date while Gathered
+		uint16_t PC;				// Shared by all the lanes while Gathered
+		bool Gathered;				// The lanes' V, I and PC live in Regs and PC instead of the machines
+		uint64_t Pending;			// Vector steps not added to the machines' CycleCount yet
+		uint16_t LastOpcode;		// OPCode of the last vector step, for the machines
+		bool OpcodeStale;			// The machines' OPCode is older than LastOpcode
+		uint64_t SameCode[4096 / 64];	// Bit n: every lane has the same opcode at address n
+
+		// Execute one instruction on all the lanes, returns the lanes a skip was taken on
+		uint32_t (*Kernel)(chip8BatchRegisters& regs, const chip8Instruction& in);
+
+		bool converged() const;
+		bool sameOpcode(uint16_t pc);
+		void gather();
+		// stepped: every machine already ran the instruction at PC, their PC, I and OPCode are newer
+		void release(uint16_t registers, bool stepped = false);
+		void stepShared(const chip8Instruction& in);
+		void stepScalar();
+};
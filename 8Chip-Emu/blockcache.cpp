@@ -0,0 +1,74 @@
+#include "blockcache.h"
+#include <string.h>
+
+chip8BlockCache::chip8BlockCache()
+{
+	Translations = 0;
+	Invalidations = 0;
+	memset(Coverage, 0, sizeof(Coverage));
+}
+
+chip8Block* chip8BlockCache::translate(const chip8Memory& memory, const chip8Instruction* table, uint16_t pc)
+{
+	chip8Block* block = new chip8Block;
+	block->Start = pc;
+	block->Length = 0;
+	block->Hits = 0;
+	block->Native = NULL;
+	block->NativeLength = 0;
+
+	uint16_t address = pc;
+	while (block->Length < BLOCK_MAX_LENGTH && address + 1 < 4096)
+	{
+		const uint16_t opcode = memory[address] << 8 | memory[address + 1];
+		block->Ops[block->Length] = table[opcode];
+		block->OPCodes[block->Length] = opcode;
+		block->Length++;
+		address += 2;
+
+		if (table[opcode].Flags & INSTR_ENDS_BLOCK)
+			break;
+	}
+
+	// Mark the bytes the block was built from so writes to them can find it
+	for (uint16_t a = pc; a < address; a++)
+		Coverage[a]++;
+
+	Blocks[pc].reset(block);
+	Translations++;
+	return block;
+}
+
+void chip8BlockCache::invalidate(uint16_t address)
+{
+	// Only blocks starting less than BLOCK_MAX_BYTES before the address can reach it
+	int first = address >= BLOCK_MAX_BYTES - 1 ? address - (BLOCK_MAX_BYTES - 1) : 0;
+
+	for (int start = first; start <= address; start++)
+	{
+		const chip8Block* block = Blocks[start].get();
+		if (block != NULL && address < block->Start + block->Length * 2)
+		{
+			remove((uint16_t)start);
+			Invalidations++;
+		}
+	}
+}
+
+void chip8BlockCache::flush()
+{
+	for (int start = 0; start < 4096; start++)
+		Blocks[start].reset();
+
+	memset(Coverage, 0, sizeof(Coverage));
+}
+
+void chip8BlockCache::remove(uint16_t start)
+{
+	const chip8Block* block = Blocks[start].get();
+
+	for (int a = start; a < start + block->Length * 2; a++)
+		Coverage[a]--;
+
+	Blocks[start].reset();
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include "chip8.h"
+
+// Basic block cache for the chip8 core
+// A block is a straight-line run of pre-decoded instructions starting at a given PC and ending
+// at the first instruction that may not fall through to PC + 2 (jump, call, return, skip),
+// draws, waits for a key or writes to Memory. Blocks are keyed by their
+// start address and thrown away when FX33/FX55 write into a byte that one of them covers.
+
+#define BLOCK_MAX_LENGTH 32						// Instructions per block
+#define BLOCK_MAX_BYTES (BLOCK_MAX_LENGTH * 2)	// Bytes of Memory a block may cover
+
+// Native code generated for the start of a block (see jit.h), gets the chip8 instance
+typedef void (*chip8NativeCode)(chip8*);
+
+struct chip8Block
+{
+	uint16_t Start;		// Address of the first instruction
+	uint16_t Length;	// Number of instructions, the last one is the only one allowed to end the block
+	chip8Instruction Ops[BLOCK_MAX_LENGTH];		// Copies of the decode table entries, kept together for locality
+	uint16_t OPCodes[BLOCK_MAX_LENGTH];
+
+	uint32_t Hits;				// Times the block ran, used by the JIT to find hot blocks
+	chip8NativeCode Native;		// Compiled code for the first NativeLength instructions or NULL
+	uint16_t NativeLength;
+};
+
+class chip8BlockCache
+{
+	public:
+		chip8BlockCache();
+
+		chip8Block* find(uint16_t pc) const { return Blocks[pc].get(); }
+
+		// Build the block that starts at pc, pc must leave room for at least one instruction
+		chip8Block* translate(const chip8Memory& memory, const chip8Instruction* table, uint16_t pc);
+
+		// True when a cached block contains the byte at address
+		bool covers(uint16_t address) const { return Coverage[address] != 0; }
+
+		// Drop every block that contains the byte at address
+		void invalidate(uint16_t address);
+
+		// Drop every block
+		void flush();
+
+		uint64_t Translations;	// Blocks built
+		uint64_t Invalidations;	// Blocks dropped because their code was overwritten
+
+	private:
+		std::unique_ptr<chip8Block> Blocks[4096];	// Indexed by start address
+		uint8_t Coverage[4096];						// Number of blocks containing each byte
+
+		void remove(uint16_t start);
+};
@@ -1,11 +1,19 @@
 #include "chip8.h"
+#include "blockcache.h"
+#include "jit.h"
+#include "romfile.h"
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <stdio.h>
+#include <atomic>
 
 chip8::chip8()
 {
+	DecodeTable = decodeTable();
+	Engine = chip8Engine::Interpreter;
+	ImageHash = 0;
+	IdleSkip = true;
 	init();
 }
 
@@ -41,7 +49,7 @@ void chip8::init() {
 	SP = 0;			// Reset stack pointer
 
 	// Clear display
-	memset(GFX, 0, sizeof(GFX)); //GFX[2048] 
+	GFX.clear();
 
 	// Clear stack
 	memset(Stack, 0, sizeof(Stack)); //Stack[16]
@@ -49,29 +57,69 @@ void chip8::init() {
 	memset(V, 0, sizeof(V)); //V[16]
 
 	// Clear memory
-	memset(Memory, 0, sizeof(Memory)); //Memory[4096]
+	Memory.clear();
 
 	// Load fontset
-	memcpy(Memory, Chip8FontSet, sizeof(Chip8FontSet));
+	Memory.write(0, Chip8FontSet, sizeof(Chip8FontSet));
+
+	// Delta save states taken before a ROM is loaded compare with this, it's the same for every machine
+	static const uint64_t initHash = hashMemory(Memory);
+	Image = Memory;
+	ImageHash = initHash;
 
 	// Reset timers
 	DelayTimer = 0;
 	SoundTimer = 0;
 
+	CycleCount = 0;
+	UnknownPC = 0xFFFF;
+	WaitKey = 0xFF;
+	Profiler.reset(PC);
+	IdleCycles = 0;
+	IdlePC = 0xFFFF;
+
+	// Forget any translated code
+	flushCode();
+
 	// Clear screen once
 	DrawFlag = true;
 
-	srand(time(NULL));
+	// Machines created in the same second still get different numbers
+	static std::atomic<uint64_t> instances(0);
+	seedRandom((uint64_t)time(NULL) ^ instances++ * 0x9E3779B97F4A7C15ULL);
+}
+
+void chip8::seedRandom(uint64_t seed)
+{
+	// splitmix64 spreads similar seeds (0, 1, 2...) over the whole state
+	uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	setRandomState(z ^ (z >> 31));
+}
+
+void chip8::setRandomState(uint64_t state)
+{
+	RandomState = state != 0 ? state : 1; // xorshift gets stuck on 0
+}
+
+uint8_t chip8::nextRandom()
+{
+	// xorshift64*, the top byte of the product is the best mixed one
+	RandomState ^= RandomState >> 12;
+	RandomState ^= RandomState << 25;
+	RandomState ^= RandomState >> 27;
+	return (uint8_t)((RandomState * 0x2545F4914F6CDD1DULL) >> 56);
 }
 
 void chip8::debugRender()
 {
 	// Draw from VRAM
-	for (int y = 0; y < 32; y++)
+	for (int y = 0; y < GFX_HEIGHT; y++)
 	{
-		for (int x = 0; x < 64; x++)
+		for (int x = 0; x < GFX_WIDTH; x++)
 		{
-			if (GFX[(y * 64) + x] == 0)
+			if (!GFX.pixel(x, y))
 				printf(" ");
 			else
 				printf("O");
@@ -83,375 +131,859 @@ void chip8::debugRender()
 
 void chip8::emulateCycle()
 {
-	// Fetch Opcode
-	OPCode = Memory[PC] << 8 | Memory[PC + 1];
+	// Fetch Opcode, a PC that ran past the end of memory wraps around
+	OPCode = Memory[PC & 0x0FFF] << 8 | Memory[(PC + 1) & 0x0FFF];
 	// Bitwise operation works something like this
 	// Memory[PC] << 8 shift the memory value 8 bits to the left ???? ???? 0000 0000 
 	// And after the result value | Memory[PC + 1] witch takes the most right 8 bits of the result that are all 0 and change them to Memory[PC + 1] value.
 	// Using this operations we get the 2 bytes we wanted from the program
 
-	printf("Exec OPCode: %#010x\n", OPCode);
+	Tracer.record(TraceLevel::Verbose, TRACE_CPU, CycleCount, PC, OPCode, I);
+	CycleCount++;
+
+	// Decode and execute Opcode, the table already holds the handler and the operand fields
+	const chip8Instruction& in = DecodeTable[OPCode];
+	Profiler.count(PC, OPCode, in.Op, in.NNN);
+	const uint64_t started = Profiler.start();
+	in.Handler(*this, in);
+	Profiler.stop(in.Op, started);
+}
+
+void chip8::emulateCycleSwitch()
+{
+	// Same as emulateCycle but decodes the opcode every time, kept as the reference for the decode table
+	OPCode = Memory[PC & 0x0FFF] << 8 | Memory[(PC + 1) & 0x0FFF];
+
+	Tracer.record(TraceLevel::Verbose, TRACE_CPU, CycleCount, PC, OPCode, I);
+	CycleCount++;
+
+	chip8Instruction in = decode(OPCode);
+	in.Handler(*this, in);
+}
+
+void chip8::tickTimers()
+{
+	// Both timers count down at 60 Hz, independently of how many instructions ran in between
+	if (DelayTimer > 0)
+		DelayTimer--;
 
-	// Decode Opcode
-	// Execute Opcode
-	switch (OPCode & 0xF000) //Let's distinguish OPCodes by the most significant value first and inside the multiple cases if needed create more switch cases
+	if (SoundTimer > 0)
 	{
-		case 0x0000:
-			switch (OPCode & 0x00FF)
-			{
-				case 0x00E0: // 00E0: Clears the screen.
-					memset(GFX, 0, sizeof(GFX)); //GFX[2048] 
-					DrawFlag = true; //Let's set this so that the draw logic knows that it needs to redraw
-					PC += 2;
-				break;
+		if (SoundTimer == 1)
+			printf("BEEP!\n");
+		SoundTimer--;
+	}
+}
 
-				case 0x00EE: // 00EE: Returns from a subroutine.
-					SP--; // 16 levels of stack, decrease stack pointer to prevent overwrite
-					PC = Stack[SP]; //Set the program counter to the saved value on the stack
-					PC += 2; //Skip to the next instruction
-				break;
+void chip8::setEngine(chip8Engine engine)
+{
+	// The JIT needs the host support and can't trace every instruction, use plain blocks without it
+	if (engine == chip8Engine::Jit && (!chip8Jit::supported() || Trace::Enabled))
+		engine = chip8Engine::BlockCache;
 
-				default:
-					// TODO: Add 0NNN
-					printf("Unknown opcode: 0x%X\n", OPCode);
-			}
-			break;
-		case 0x1000:// 1NNN: Jumps to address NNN.
-			PC = OPCode & 0x0FFF;
-		break;
-
-		case 0x2000:// 0x2NNN: Calls subroutine at NNN.
-			Stack[SP] = PC; // Let's save the current adress to the stack
-			SP++; // Increment the stack pointer
-			PC = OPCode & 0x0FFF; // Let's save the only the NNN value to the PC
-		break;
-
-		case 0x3000:// 3XNN: Skips the next instruction if VX equals NN. (Usually the next instruction is a jump to skip a code block)
-			if (V[(OPCode & 0x0F00) >> 8] == (OPCode & 0x00FF))
-				PC += 4;
-			else // We still need to read the next if instruction even if VX != NN
-				PC += 2;
-		break;
-
-		case 0x4000:// 4XNN: Skips the next instruction if VX doesn't equal NN. (Usually the next instruction is a jump to skip a code block)
-			if (V[(OPCode & 0x0F00) >> 8] != (OPCode & 0x00FF))
-				PC += 4;
-			else // We still need to read the next if instruction even if VX == NN
-				PC += 2;
-		break;
-
-		case 0x5000:// 5XY0: Skips the next instruction if VX equals VY. (Usually the next instruction is a jump to skip a code block)
-			if (V[(OPCode & 0x0F00) >> 8] == V[(OPCode & 0x00F0) >> 4])
-				PC += 4;
-			else // We still need to read the next if instruction even if VX != VY
-				PC += 2;
-		break;
-
-		case 0x6000:// 6XNN: Sets VX to NN.
-			V[(OPCode & 0x0F00) >> 8] = OPCode & 0x00FF; //Don't forget to shift the value 8 bitsso that it represents the value that we want
-			PC += 2;
-		break;
-
-		case 0x7000:// 7XNN: Adds NN to VX. (Carry flag is not changed)
-			V[(OPCode & 0x0F00) >> 8] += OPCode & 0x00FF;
-			PC += 2;
-		break;
+	// Profiles are counted one instruction at a time
+	if (Profile::Enabled)
+		engine = chip8Engine::Interpreter;
 
-		case 0x8000:
-			switch (OPCode & 0x000F)
-			{
-			case 0x0000: // 8XY0: Sets VX to the value of VY.
-				V[(OPCode & 0x0F00) >> 8] = V[(OPCode & 0x00F0) >> 4];
-				PC += 2; //Skip to the next instruction
-			break;
+	Engine = engine;
 
-			case 0x0001: // 8XY1: Sets VX to VX or VY. (Bitwise OR operation)
-				V[(OPCode & 0x0F00) >> 8] = (V[(OPCode & 0x0F00) >> 8] | V[(OPCode & 0x00F0) >> 4]);
-				PC += 2;
-			break;
+	if (Engine == chip8Engine::Interpreter)
+		Blocks.reset();
+	else if (!Blocks)
+		Blocks.reset(new chip8BlockCache());
 
-			case 0x0002: // 8XY2: Sets VX to VX and VY. (Bitwise AND operation)
-				V[(OPCode & 0x0F00) >> 8] = (V[(OPCode & 0x0F00) >> 8] & V[(OPCode & 0x00F0) >> 4]);
-				PC += 2;
-			break;
+	if (Engine == chip8Engine::Jit)
+	{
+		if (!Jit)
+			Jit.reset(new chip8Jit());
+	}
+	else
+	{
+		// Blocks compiled before point into the arena that goes away with the JIT
+		if (Jit && Blocks)
+			Blocks->flush();
+		Jit.reset();
+	}
+}
 
-			case 0x0003:// 8XY3: Sets VX to VX xor VY.
-				V[(OPCode & 0x0F00) >> 8] = (V[(OPCode & 0x0F00) >> 8] ^ V[(OPCode & 0x00F0) >> 4]);
-				PC += 2;
-			break;
+void chip8::flushCode()
+{
+	if (Blocks)
+		Blocks->flush();
+	if (Jit)
+		Jit->reset();
+}
 
-			case 0x0004:// 8XY4: Adds VY to VX. VF is set to 1 when there's a carry, and to 0 when there isn't.
-				if (V[(OPCode & 0x00F0) >> 4] > (0xFF - V[(OPCode & 0x0F00) >> 8])) //If VY > 0xFF - VX then VX+VY will have a carry
-					V[0xF] = 1; //carry
-				else
-					V[0xF] = 0;
-				V[(OPCode & 0x0F00) >> 8] = (V[(OPCode & 0x0F00) >> 8] + V[(OPCode & 0x00F0) >> 4]);
-				PC += 2;
-			break;
+uint64_t chip8::run(uint64_t cycles)
+{
+	if (Engine != chip8Engine::Interpreter)
+		return runBlocks(cycles);
 
-			case 0x0005:// 8XY5: VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
-				if (V[(OPCode & 0x00F0) >> 4] > V[(OPCode & 0x0F00) >> 8]) //If VY > 0xFF - VX then VX+VY will have a carry
-					V[0xF] = 0; //borrow
-				else
-					V[0xF] = 1;
-				V[(OPCode & 0x0F00) >> 8] = (V[(OPCode & 0x0F00) >> 8] - V[(OPCode & 0x00F0) >> 4]);
-				PC += 2;
-			break;
+	uint64_t executed = 0;
+	uint64_t idleCheck = 0;
+	while (executed < cycles)
+	{
+		if (executed >= idleCheck)
+		{
+			executed += skipIdle(cycles - executed);
+			idleCheck = executed + IDLE_CHECK_INTERVAL;
+			continue;
+		}
 
-			case 0x0006:// 8XY6: Stores the least significant bit of VX in VF and then shifts VX to the right by 1
-				V[0xF] = V[(OPCode & 0x0F00) >> 8] & 0x01;
-				V[(OPCode & 0x0F00) >> 8] = (V[(OPCode & 0x0F00) >> 8] >> 1); //shift to right by one
-				PC += 2;
-			break;
+		emulateCycle();
+		executed++;
 
-			case 0x0007:// 8XY7: Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
-				if (V[(OPCode & 0x0F00) >> 8] > V[(OPCode & 0x00F0) >> 4]) //If VY > 0xFF - VX then VX+VY will have a carry
-					V[0xF] = 0; //borrow
-				else
-					V[0xF] = 1;
-				V[(OPCode & 0x0F00) >> 8] = (V[(OPCode & 0x00F0) >> 4] - V[(OPCode & 0x0F00) >> 8]);
-				PC += 2;
+		if (DrawFlag)
 			break;
+	}
+
+	return executed;
+}
+
+uint64_t chip8::runBlocks(uint64_t cycles)
+{
+	uint64_t executed = 0;
+	uint64_t idleCheck = 0;
+	while (executed < cycles)
+	{
+		if (executed >= idleCheck)
+		{
+			executed += skipIdle(cycles - executed);
+			idleCheck = executed + IDLE_CHECK_INTERVAL;
+			continue;
+		}
+
+		chip8Block* block = NULL;
+
+		// The last instruction in Memory can't be part of a block
+		if (PC + 1 < 4096)
+		{
+			block = Blocks->find(PC);
+			if (block == NULL)
+				block = Blocks->translate(Memory, DecodeTable, PC);
+		}
 
-			case 0x000E:// 8XYE: Stores the most significant bit of VX in VF and then shifts VX to the left by 1.
-				V[0xF] = V[(OPCode & 0x0F00) >> 8] >> 7; //Shift 7 bits to the right to get the most significant bit only
-				V[(OPCode & 0x0F00) >> 8] = (V[(OPCode & 0x0F00) >> 8] << 1); //shift to left by one
-				PC += 2;
+		// Not enough cycles left to run the whole block, finish one instruction at a time
+		if (block == NULL || block->Length > cycles - executed)
+		{
+			emulateCycle();
+			executed++;
+		}
+		else if (block->Length == 1)
+		{
+			// Single instruction blocks (tight jump loops) don't need the block bookkeeping.
+			// A copy is executed because FX33/FX55 can drop the block while they run.
+			const chip8Instruction in = block->Ops[0];
+			OPCode = block->OPCodes[0];
+			Tracer.record(TraceLevel::Verbose, TRACE_CPU, CycleCount, PC, OPCode, I);
+			CycleCount++;
+			execute(in);
+			executed++;
+		}
+		else
+		{
+			executed += block->Length;
+			executeBlock(*block);
+
+			// Out of executable memory, start over with an empty cache
+			if (Jit && Jit->full())
+				flushCode();
+		}
+
+		if (DrawFlag)
 			break;
+	}
 
-			default:
-				printf("Unknown opcode: 0x%X\n", OPCode);
-			}
+	return executed;
+}
+
+bool chip8::waitingForKey() const
+{
+	const uint16_t opcode = Memory[PC & 0x0FFF] << 8 | Memory[(PC + 1) & 0x0FFF];
+	if (!(DecodeTable[opcode].Flags & INSTR_WAIT) || DelayTimer != 0 || SoundTimer != 0)
+		return false;
+
+	// Running FX0A again would either take a key that's down or finish with one that was released
+	return WaitKey == 0xFF ? getKeys() == 0 : Key[WaitKey] != 0;
+}
+
+uint64_t chip8::skipIdle(uint64_t cycles)
+{
+	// Only worth a look when PC stayed around the same place since the last one, it always does in
+	// an idle loop
+	const uint16_t last = IdlePC;
+	IdlePC = PC;
+	if (!IdleSkip || Trace::Enabled || Profile::Enabled || (uint16_t)(PC - last + 2 * IDLE_MAX_LOOP) > 4 * IDLE_MAX_LOOP)
+		return 0;
+
+	// Run the loop for real. If the machine comes back to the same PC in the same state the loop
+	// can't do anything else until a timer or key changes, and those only change between runs.
+	// The state includes the key FX0A took, finishing an FX0A in the loop can look like a fixed point.
+	// Memory and the screen can't change because instructions writing them end the look.
+	uint16_t pc, index, sp;
+	uint8_t delayTimer, soundTimer, waitKey;
+	uint64_t randomState;
+	uint8_t v[16];
+	uint16_t stack[16];
+	auto snapshot = [&]()
+	{
+		pc = PC;
+		index = I;
+		sp = SP;
+		delayTimer = DelayTimer;
+		soundTimer = SoundTimer;
+		waitKey = WaitKey;
+		randomState = RandomState;
+		memcpy(v, V, sizeof(V));
+		memcpy(stack, Stack, sizeof(Stack));
+	};
+	snapshot();
+
+	// The first instructions after the timers ticked pick up their new values (FX07 polling the
+	// delay timer), so the look starts over after every change instead of giving up. The loop can
+	// then still be recognized in the same run, a run is often only a few turns at 60 Hz frames.
+	uint64_t executed = 0;
+	uint64_t turn = 0;		// Where the last change was
+	uint16_t trailPC[IDLE_MAX_LOOP], trailOPCode[IDLE_MAX_LOOP];	// Where every instruction since then left off
+	while (executed - turn < IDLE_MAX_LOOP && executed < 2 * IDLE_MAX_LOOP && executed < cycles)
+	{
+		const uint16_t opcode = Memory[PC & 0x0FFF] << 8 | Memory[(PC + 1) & 0x0FFF];
+		if (DecodeTable[opcode].Flags & (INSTR_STORE | INSTR_DRAW | INSTR_UNKNOWN))
 			break;
-		case 0x9000:// 9XY0: Skips the next instruction if VX doesn't equal VY. (Usually the next instruction is a jump to skip a code block)
-			if (V[(OPCode & 0x0F00) >> 8] != V[(OPCode & 0x00F0) >> 4])
-				PC += 4;
-			else // We still need to read the next if instruction even if VX == VY
-				PC += 2;
-		break;
-
-		case 0xA000: // ANNN: Sets I to the address NNN.
-			I = OPCode & 0x0FFF;
-			PC += 2;
-		break;
-
-		case 0xB000:// BNNN: Jumps to the address NNN plus V0.
-			PC = (OPCode & 0x0FFF) + V[0];
-		break;
-
-		case 0xC000:// CXNN: Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN.
-			V[(OPCode & 0x0F00) >> 8] = (rand() % 0x00FF) & (OPCode & 0x00FF);
-			PC += 2;
-		break;
-
-		case 0xD000: // DXYN: Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N pixels.
-					 // Each row of 8 pixels is read as bit-coded starting from memory location I;
-					 // I value doesnt change after the execution of this instruction.
-					 // As described above, VF is set to 1 if any screen pixels are flipped from set to unset when the sprite is drawn, and to 0 if that doesnt happen 
+
+		emulateCycle();
+		executed++;
+
+		if (I != index || SP != sp || DelayTimer != delayTimer || SoundTimer != soundTimer || WaitKey != waitKey || RandomState != randomState ||
+			memcmp(V, v, sizeof(V)) != 0 || memcmp(Stack, stack, sizeof(Stack)) != 0)
+		{
+			snapshot();
+			turn = executed;
+			continue;
+		}
+
+		trailPC[executed - turn - 1] = PC;
+		trailOPCode[executed - turn - 1] = OPCode;
+		if (PC == pc)
+		{
+			// Nothing but PC changed along the loop, so the part of a turn that's left over only has
+			// to put PC and OPCode where that many instructions would
+			const uint64_t length = executed - turn;
+			const uint64_t skipped = cycles - executed;
+			const uint64_t partial = skipped % length;
+			if (partial > 0)
 			{
-				// Get the VX and VY coordinate
-				uint16_t x = V[(OPCode & 0x0F00) >> 8];
-				uint16_t y = V[(OPCode & 0x00F0) >> 4];
-				//Get height
-				uint16_t height = OPCode & 0x000F;
-				//Pixel that we get from memory
-				uint16_t pixel;
-
-				//Let's assume that VF won't be changed
-				V[0xF] = 0;
-
-				for (int yLine = 0; yLine < height; yLine++)
-				{
-					pixel = Memory[I + yLine]; // Get the byte representing the pixel
-												// the pixel is enconded for example if screen is clear 11110000 will give ****EEEE, E being blank
-					for (int xLine = 0; xLine < 8; xLine++)
-					{
-						if ((pixel & (0x80 >> xLine)) != 0) // Test values from left to right by using 0x80 and a bitshift to the right
-						{
-							if (GFX[(x + xLine + ((y + yLine) * 64))] == 1)
-							{
-								V[0xF] = 1; //A pixel as been changed from set to unset
-							}
-							GFX[x + xLine + ((y + yLine) * 64)] ^= 1; //XOR operation on the current value inside the VRAM
-						}
-					}
-				}
-
-				DrawFlag = true;
-				PC += 2;
+				PC = trailPC[partial - 1];
+				OPCode = trailOPCode[partial - 1];
 			}
-		break;
+			CycleCount += skipped;
+			IdleCycles += skipped;
+			return executed + skipped;
+		}
+	}
 
-		case 0xE000:
-			switch (OPCode & 0x00FF)
+	return executed;
+}
+
+void chip8::executeBlock(chip8Block& block)
+{
+	// The block can be dropped by its own last instruction (FX33/FX55), so that one runs from a copy
+	// and the block isn't touched after it
+	const uint16_t length = block.Length;
+	const chip8Instruction last = block.Ops[length - 1];
+	uint16_t n = 0;
+
+	// Compiled blocks run their native part first, the others count towards getting compiled
+	if (block.Native != NULL)
+	{
+		block.Native(this);
+		n = block.NativeLength;
+	}
+	else if (Jit && ++block.Hits == JIT_HOT_THRESHOLD)
+		Jit->compile(block, *this);
+
+	for (; n + 1 < length; n++)
+	{
+		if (Trace::Enabled)
+		{
+			OPCode = block.OPCodes[n];
+			Tracer.record(TraceLevel::Verbose, TRACE_CPU, CycleCount, PC, OPCode, I);
+			CycleCount++;
+		}
+		execute(block.Ops[n]);
+	}
+
+	OPCode = block.OPCodes[length - 1];
+	if (Trace::Enabled)
+	{
+		Tracer.record(TraceLevel::Verbose, TRACE_CPU, CycleCount, PC, OPCode, I);
+		CycleCount++;
+	}
+	else
+		CycleCount += length;
+
+	execute(last);
+}
+
+void chip8::execute(const chip8Instruction& in)
+{
+	// Same as calling in.Handler but with direct calls the compiler can inline
+	switch (in.Op)
+	{
+		case OP_00E0: op00E0(*this, in); break;
+		case OP_00EE: op00EE(*this, in); break;
+		case OP_1NNN: op1NNN(*this, in); break;
+		case OP_2NNN: op2NNN(*this, in); break;
+		case OP_3XNN: op3XNN(*this, in); break;
+		case OP_4XNN: op4XNN(*this, in); break;
+		case OP_5XY0: op5XY0(*this, in); break;
+		case OP_6XNN: op6XNN(*this, in); break;
+		case OP_7XNN: op7XNN(*this, in); break;
+		case OP_8XY0: op8XY0(*this, in); break;
+		case OP_8XY1: op8XY1(*this, in); break;
+		case OP_8XY2: op8XY2(*this, in); break;
+		case OP_8XY3: op8XY3(*this, in); break;
+		case OP_8XY4: op8XY4(*this, in); break;
+		case OP_8XY5: op8XY5(*this, in); break;
+		case OP_8XY6: op8XY6(*this, in); break;
+		case OP_8XY7: op8XY7(*this, in); break;
+		case OP_8XYE: op8XYE(*this, in); break;
+		case OP_9XY0: op9XY0(*this, in); break;
+		case OP_ANNN: opANNN(*this, in); break;
+		case OP_BNNN: opBNNN(*this, in); break;
+		case OP_FX1E: opFX1E(*this, in); break;
+		case OP_FX29: opFX29(*this, in); break;
+		default: in.Handler(*this, in); break; // The bigger handlers are not worth inlining
+	}
+}
+
+void chip8::writeMemory(uint16_t address, uint8_t value)
+{
+	address &= 0x0FFF; // Stay inside the 4k of Memory
+	Memory.write(address, value);
+
+	if (Blocks && Blocks->covers(address))
+		Blocks->invalidate(address);
+}
+
+void chip8::forkFrom(const chip8& parent)
+{
+	PC = parent.PC;
+	OPCode = parent.OPCode;
+	I = parent.I;
+	SP = parent.SP;
+
+	GFX.setRows(parent.GFX.row(0)); // Also marks the whole screen dirty, it's another picture now
+	memcpy(V, parent.V, sizeof(V));
+	memcpy(Stack, parent.Stack, sizeof(Stack));
+	memcpy(Key, parent.Key, sizeof(Key));
+
+	DelayTimer = parent.DelayTimer;
+	SoundTimer = parent.SoundTimer;
+	DrawFlag = parent.DrawFlag;
+	CycleCount = parent.CycleCount;
+	UnknownPC = parent.UnknownPC;
+	WaitKey = parent.WaitKey;
+	IdlePC = 0xFFFF; // The last look was at another machine
+	RandomState = parent.RandomState;
+
+	// Only the page pointers are copied
+	Memory = parent.Memory;
+	Image = parent.Image;
+	ImageHash = parent.ImageHash;
+
+	flushCode(); // Translated code belongs to the old memory
+}
+
+bool chip8::sameState(const chip8& other) const
+{
+	return PC == other.PC && OPCode == other.OPCode && I == other.I && SP == other.SP
+		&& DelayTimer == other.DelayTimer && SoundTimer == other.SoundTimer
+		&& CycleCount == other.CycleCount && DrawFlag == other.DrawFlag
+		&& RandomState == other.RandomState && WaitKey == other.WaitKey
+		&& memcmp(V, other.V, sizeof(V)) == 0
+		&& memcmp(Stack, other.Stack, sizeof(Stack)) == 0
+		&& Memory == other.Memory
+		&& GFX == other.GFX
+		&& memcmp(Key, other.Key, sizeof(Key)) == 0;
+}
+
+// profile.h can't include this header, it keeps its own copy of these
+static_assert(OP_FX65 + 1 == PROFILE_OPS && OP_2NNN == PROFILE_OP_CALL && OP_00EE == PROFILE_OP_RETURN, "profile.h doesn't match chip8Op");
+
+// Pre-decoded handler for every possible opcode, built once for all the instances
+struct chip8DecodeTable
+{
+	chip8Instruction Entries[0x10000];
+
+	chip8DecodeTable()
+	{
+		for (uint32_t opcode = 0; opcode < 0x10000; opcode++)
+			Entries[opcode] = chip8::decode((uint16_t)opcode);
+	}
+};
+
+const chip8Instruction* chip8::decodeTable()
+{
+	static const chip8DecodeTable table;
+	return table.Entries;
+}
+
+chip8Instruction chip8::decode(uint16_t opcode)
+{
+	chip8Instruction in;
+
+	// Extract every operand field once, each handler only reads the ones it needs
+	in.NNN = opcode & 0x0FFF;
+	in.X = (opcode & 0x0F00) >> 8;
+	in.Y = (opcode & 0x00F0) >> 4;
+	in.NN = opcode & 0x00FF;
+	in.N = opcode & 0x000F;
+	in.Handler = &chip8::opUnknown;
+	in.Flags = 0;
+	in.Op = OP_UNKNOWN;
+
+	switch (opcode & 0xF000) //Let's distinguish OPCodes by the most significant value first and inside the multiple cases if needed create more switch cases
+	{
+		case 0x0000:
+			switch (opcode & 0x00FF)
 			{
-			case 0x009E:// EX9E: Skips the next instruction if the key stored in VX is pressed. (Usually the next instruction is a jump to skip a code block)
-				if (Key[V[(OPCode & 0x0F00) >> 8]] == 1)
-					PC += 4;
-				else
-					PC += 2;
+				case 0x00E0: in.Handler = &chip8::op00E0; in.Op = OP_00E0; in.Flags = INSTR_DRAW; break;
+				case 0x00EE: in.Handler = &chip8::op00EE; in.Op = OP_00EE; in.Flags = INSTR_BRANCH; break;
+				// TODO: Add 0NNN
+			}
 			break;
-
-			case 0x00A1:// EXA1: Skips the next instruction if the key stored in VX isn't pressed. (Usually the next instruction is a jump to skip a code block)
-				if (Key[V[(OPCode & 0x0F00) >> 8]] == 0)
-					PC += 4;
-				else
-					PC += 2;
+		case 0x1000: in.Handler = &chip8::op1NNN; in.Op = OP_1NNN; in.Flags = INSTR_BRANCH; break;
+		case 0x2000: in.Handler = &chip8::op2NNN; in.Op = OP_2NNN; in.Flags = INSTR_BRANCH; break;
+		case 0x3000: in.Handler = &chip8::op3XNN; in.Op = OP_3XNN; in.Flags = INSTR_BRANCH; break;
+		case 0x4000: in.Handler = &chip8::op4XNN; in.Op = OP_4XNN; in.Flags = INSTR_BRANCH; break;
+		case 0x5000: in.Handler = &chip8::op5XY0; in.Op = OP_5XY0; in.Flags = INSTR_BRANCH; break;
+		case 0x6000: in.Handler = &chip8::op6XNN; in.Op = OP_6XNN; break;
+		case 0x7000: in.Handler = &chip8::op7XNN; in.Op = OP_7XNN; break;
+		case 0x8000:
+			switch (opcode & 0x000F)
+			{
+				case 0x0000: in.Handler = &chip8::op8XY0; in.Op = OP_8XY0; break;
+				case 0x0001: in.Handler = &chip8::op8XY1; in.Op = OP_8XY1; break;
+				case 0x0002: in.Handler = &chip8::op8XY2; in.Op = OP_8XY2; break;
+				case 0x0003: in.Handler = &chip8::op8XY3; in.Op = OP_8XY3; break;
+				case 0x0004: in.Handler = &chip8::op8XY4; in.Op = OP_8XY4; break;
+				case 0x0005: in.Handler = &chip8::op8XY5; in.Op = OP_8XY5; break;
+				case 0x0006: in.Handler = &chip8::op8XY6; in.Op = OP_8XY6; break;
+				case 0x0007: in.Handler = &chip8::op8XY7; in.Op = OP_8XY7; break;
+				case 0x000E: in.Handler = &chip8::op8XYE; in.Op = OP_8XYE; break;
+			}
 			break;
-
-			default:
-				printf("Unknown opcode: 0x%X\n", OPCode);
+		case 0x9000: in.Handler = &chip8::op9XY0; in.Op = OP_9XY0; in.Flags = INSTR_BRANCH; break;
+		case 0xA000: in.Handler = &chip8::opANNN; in.Op = OP_ANNN; break;
+		case 0xB000: in.Handler = &chip8::opBNNN; in.Op = OP_BNNN; in.Flags = INSTR_BRANCH; break;
+		case 0xC000: in.Handler = &chip8::opCXNN; in.Op = OP_CXNN; break;
+		case 0xD000: in.Handler = &chip8::opDXYN; in.Op = OP_DXYN; in.Flags = INSTR_DRAW; break;
+		case 0xE000:
+			switch (opcode & 0x00FF)
+			{
+				case 0x009E: in.Handler = &chip8::opEX9E; in.Op = OP_EX9E; in.Flags = INSTR_BRANCH; break;
+				case 0x00A1: in.Handler = &chip8::opEXA1; in.Op = OP_EXA1; in.Flags = INSTR_BRANCH; break;
 			}
 			break;
 		case 0xF000:
-			switch (OPCode & 0x00FF)
+			switch (opcode & 0x00FF)
 			{
-				case 0x0007:// FX07: Sets VX to the value of the delay timer.
-					V[(OPCode & 0x0F00) >> 8] = DelayTimer;
-					PC += 2;
-				break;
+				case 0x0007: in.Handler = &chip8::opFX07; in.Op = OP_FX07; in.Flags = INSTR_TIMER; break;
+				case 0x000A: in.Handler = &chip8::opFX0A; in.Op = OP_FX0A; in.Flags = INSTR_WAIT; break;
+				case 0x0015: in.Handler = &chip8::opFX15; in.Op = OP_FX15; in.Flags = INSTR_TIMER; break;
+				case 0x0018: in.Handler = &chip8::opFX18; in.Op = OP_FX18; in.Flags = INSTR_TIMER; break;
+				case 0x001E: in.Handler = &chip8::opFX1E; in.Op = OP_FX1E; break;
+				case 0x0029: in.Handler = &chip8::opFX29; in.Op = OP_FX29; break;
+				case 0x0033: in.Handler = &chip8::opFX33; in.Op = OP_FX33; in.Flags = INSTR_STORE; break;
+				case 0x0055: in.Handler = &chip8::opFX55; in.Op = OP_FX55; in.Flags = INSTR_STORE; break;
+				case 0x0065: in.Handler = &chip8::opFX65; in.Op = OP_FX65; break;
+			}
+			break;
+	}
 
-				case 0x000A:// FX0A: A key press is awaited, and then stored in VX. (Blocking Operation. All instruction halted until next key event)
-					{
-					bool keyPressed = false;
-
-					for (int i = 0; i < 16; ++i) //Maybe add a or keyPressed inside the for condition
-					{
-						if (Key[i] != 0)
-						{
-							V[(OPCode & 0x0F00) >> 8] = i;
-							keyPressed = true;
-						}
-					}
-
-					// If we didn't received a keypress, skip this cycle and try again.
-					if (!keyPressed)
-						return;
-
-					PC += 2;
-					}
-				break;
+	if (in.Handler == &chip8::opUnknown)
+		in.Flags = INSTR_UNKNOWN;
 
-				case 0x0015:// FX15: Sets the delay timer to VX.
-					DelayTimer = V[(OPCode & 0x0F00) >> 8];
-					PC += 2;
-				break;
+	return in;
+}
 
-				case 0x0018:// FX18: Sets the sound timer to VX.
-					SoundTimer = V[(OPCode & 0x0F00) >> 8];
-					PC += 2;
-				break;
+void chip8::opUnknown(chip8& c, const chip8Instruction&)
+{
+	c.unknownOpcode();
+}
+
+void chip8::op00E0(chip8& c, const chip8Instruction&)
+{
+	// 00E0: Clears the screen.
+	c.GFX.clear();
+	c.DrawFlag = true; //Let's set this so that the draw logic knows that it needs to redraw
+	c.PC += 2;
+}
 
-				case 0x001E:// FX1E: Adds VX to I. VF is set to 1 when there is a range overflow (I+VX>0xFFF), and to 0 when there isn't.
-					if (I + V[(OPCode & 0x0F00) >> 8] > 0x0FFF)
-						V[0xF] = 1;
-					else
-						V[0xF] = 0;
+void chip8::op00EE(chip8& c, const chip8Instruction&)
+{
+	// 00EE: Returns from a subroutine.
+	c.SP = (c.SP - 1) & 0xF; // 16 levels of stack, decrease stack pointer to prevent overwrite (wraps around on underflow)
+	c.PC = c.Stack[c.SP]; //Set the program counter to the saved value on the stack
+	c.PC += 2; //Skip to the next instruction
+}
 
-					I = I + V[(OPCode & 0x0F00) >> 8];
-					PC += 2;
-				break;
+void chip8::op1NNN(chip8& c, const chip8Instruction& in)
+{
+	// 1NNN: Jumps to address NNN.
+	c.PC = in.NNN;
+}
 
-				case 0x0029:// FX29: Sets I to the location of the sprite for the character in VX. Characters 0-F (in hexadecimal) are represented by a 4x5 font.
-					I = V[((OPCode & 0x0F00) >> 8)] * 0x5; //The sprites are 5 bytes long therefore we need to implement a 0x5 offset to find each char
-					PC += 2;
-				break;
+void chip8::op2NNN(chip8& c, const chip8Instruction& in)
+{
+	// 0x2NNN: Calls subroutine at NNN.
+	c.Stack[c.SP] = c.PC; // Let's save the current adress to the stack
+	c.SP = (c.SP + 1) & 0xF; // Increment the stack pointer, wraps around after 16 levels
+	c.PC = in.NNN; // Let's save the only the NNN value to the PC
+}
 
-				case 0x0033: // FX33: Stores the binary-coded decimal representation of VX, with the most significant of three digits at the address in I, the middle digit at I plus 1,
-							 // and the least significant digit at I plus 2. 
-							 //(In other words, take the decimal representation of VX, place the hundreds digit in memory at location in I,
-							 //the tens digit at location I+1, and the ones digit at location I+2.)
-					Memory[I] = V[(OPCode & 0x0F00) >> 8] / 100; //Get the most significant digit
-					Memory[I + 1] = (V[(OPCode & 0x0F00) >> 8] / 10) % 10;   //Get the middle digit
-					Memory[I + 2] = (V[(OPCode & 0x0F00) >> 8] % 100) % 10;   //Get the least significant digit
-					PC += 2;
-				break;
+void chip8::op3XNN(chip8& c, const chip8Instruction& in)
+{
+	// 3XNN: Skips the next instruction if VX equals NN. (Usually the next instruction is a jump to skip a code block)
+	if (c.V[in.X] == in.NN)
+		c.PC += 4;
+	else // We still need to read the next if instruction even if VX != NN
+		c.PC += 2;
+}
 
-				case 0x0055:// FX55: Stores V0 to VX (including VX) in memory starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified.
-					for (int i = 0; i <= ((OPCode & 0x0F00) >> 8); i++)
-						Memory[I + i] = V[i];
-					// On the original CHIP-8 and CHIP-48, when the operation is done, I = I + X + 1.
-					I += ((OPCode & 0x0F00) >> 8) + 1;
-					PC += 2;
-				break;
+void chip8::op4XNN(chip8& c, const chip8Instruction& in)
+{
+	// 4XNN: Skips the next instruction if VX doesn't equal NN. (Usually the next instruction is a jump to skip a code block)
+	if (c.V[in.X] != in.NN)
+		c.PC += 4;
+	else // We still need to read the next if instruction even if VX == NN
+		c.PC += 2;
+}
 
-				case 0x0065: // FX65: Fills V0 to VX (including VX) with values from memory starting at address I.
-					for (int i = 0; i <= ((OPCode & 0x0F00) >> 8); i++) {
-						V[i] = Memory[I + i];
-					}
-					// On the original CHIP-8 and CHIP-48, when the operation is done, I = I + X + 1.
-					I += ((OPCode & 0x0F00) >> 8) + 1;
-					PC += 2;
-				break;
+void chip8::op5XY0(chip8& c, const chip8Instruction& in)
+{
+	// 5XY0: Skips the next instruction if VX equals VY. (Usually the next instruction is a jump to skip a code block)
+	if (c.V[in.X] == c.V[in.Y])
+		c.PC += 4;
+	else // We still need to read the next if instruction even if VX != VY
+		c.PC += 2;
+}
+
+void chip8::op6XNN(chip8& c, const chip8Instruction& in)
+{
+	// 6XNN: Sets VX to NN.
+	c.V[in.X] = in.NN;
+	c.PC += 2;
+}
+
+void chip8::op7XNN(chip8& c, const chip8Instruction& in)
+{
+	// 7XNN: Adds NN to VX. (Carry flag is not changed)
+	c.V[in.X] += in.NN;
+	c.PC += 2;
+}
+
+void chip8::op8XY0(chip8& c, const chip8Instruction& in)
+{
+	// 8XY0: Sets VX to the value of VY.
+	c.V[in.X] = c.V[in.Y];
+	c.PC += 2; //Skip to the next instruction
+}
+
+void chip8::op8XY1(chip8& c, const chip8Instruction& in)
+{
+	// 8XY1: Sets VX to VX or VY. (Bitwise OR operation)
+	c.V[in.X] = (c.V[in.X] | c.V[in.Y]);
+	c.PC += 2;
+}
+
+void chip8::op8XY2(chip8& c, const chip8Instruction& in)
+{
+	// 8XY2: Sets VX to VX and VY. (Bitwise AND operation)
+	c.V[in.X] = (c.V[in.X] & c.V[in.Y]);
+	c.PC += 2;
+}
+
+void chip8::op8XY3(chip8& c, const chip8Instruction& in)
+{
+	// 8XY3: Sets VX to VX xor VY.
+	c.V[in.X] = (c.V[in.X] ^ c.V[in.Y]);
+	c.PC += 2;
+}
+
+void chip8::op8XY4(chip8& c, const chip8Instruction& in)
+{
+	// 8XY4: Adds VY to VX. VF is set to 1 when there's a carry, and to 0 when there isn't.
+	if (c.V[in.Y] > (0xFF - c.V[in.X])) //If VY > 0xFF - VX then VX+VY will have a carry
+		c.V[0xF] = 1; //carry
+	else
+		c.V[0xF] = 0;
+	c.V[in.X] = (c.V[in.X] + c.V[in.Y]);
+	c.PC += 2;
+}
+
+void chip8::op8XY5(chip8& c, const chip8Instruction& in)
+{
+	// 8XY5: VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
+	if (c.V[in.Y] > c.V[in.X]) //If VY > VX then VX-VY will have a borrow
+		c.V[0xF] = 0; //borrow
+	else
+		c.V[0xF] = 1;
+	c.V[in.X] = (c.V[in.X] - c.V[in.Y]);
+	c.PC += 2;
+}
+
+void chip8::op8XY6(chip8& c, const chip8Instruction& in)
+{
+	// 8XY6: Stores the least significant bit of VX in VF and then shifts VX to the right by 1
+	c.V[0xF] = c.V[in.X] & 0x01;
+	c.V[in.X] = (c.V[in.X] >> 1); //shift to right by one
+	c.PC += 2;
+}
+
+void chip8::op8XY7(chip8& c, const chip8Instruction& in)
+{
+	// 8XY7: Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
+	if (c.V[in.X] > c.V[in.Y]) //If VX > VY then VY-VX will have a borrow
+		c.V[0xF] = 0; //borrow
+	else
+		c.V[0xF] = 1;
+	c.V[in.X] = (c.V[in.Y] - c.V[in.X]);
+	c.PC += 2;
+}
+
+void chip8::op8XYE(chip8& c, const chip8Instruction& in)
+{
+	// 8XYE: Stores the most significant bit of VX in VF and then shifts VX to the left by 1.
+	c.V[0xF] = c.V[in.X] >> 7; //Shift 7 bits to the right to get the most significant bit only
+	c.V[in.X] = (c.V[in.X] << 1); //shift to left by one
+	c.PC += 2;
+}
+
+void chip8::op9XY0(chip8& c, const chip8Instruction& in)
+{
+	// 9XY0: Skips the next instruction if VX doesn't equal VY. (Usually the next instruction is a jump to skip a code block)
+	if (c.V[in.X] != c.V[in.Y])
+		c.PC += 4;
+	else // We still need to read the next if instruction even if VX == VY
+		c.PC += 2;
+}
+
+void chip8::opANNN(chip8& c, const chip8Instruction& in)
+{
+	// ANNN: Sets I to the address NNN.
+	c.I = in.NNN;
+	c.PC += 2;
+}
+
+void chip8::opBNNN(chip8& c, const chip8Instruction& in)
+{
+	// BNNN: Jumps to the address NNN plus V0.
+	c.PC = in.NNN + c.V[0];
+}
+
+void chip8::opCXNN(chip8& c, const chip8Instruction& in)
+{
+	// CXNN: Sets VX to the result of a bitwise and operation on a random number (Typically: 0 to 255) and NN.
+	c.V[in.X] = c.nextRandom() & in.NN;
+	c.PC += 2;
+}
+
+void chip8::opDXYN(chip8& c, const chip8Instruction& in)
+{
+	// DXYN: Draws a sprite at coordinate (VX, VY) that has a width of 8 pixels and a height of N pixels.
+	// Each row of 8 pixels is read as bit-coded starting from memory location I;
+	// I value doesn't change after the execution of this instruction.
+	// As described above, VF is set to 1 if any screen pixels are flipped from set to unset when the sprite is drawn, and to 0 if that doesn't happen 
+
+	// Get the VX and VY coordinate, the starting position wraps around the screen
+	int x = c.V[in.X] % GFX_WIDTH;
+	int y = c.V[in.Y] % GFX_HEIGHT;
+	//Get height
+	int height = in.N;
+	// Sprite bytes are already in the framebuffer bit order, for example 11110000 will give ****EEEE, E being blank.
+	// They are copied out first because the sprite may wrap around the end of Memory.
+	uint8_t sprite[16];
+	for (int yLine = 0; yLine < height; yLine++)
+		sprite[yLine] = c.Memory[(c.I + yLine) & 0x0FFF];
+
+	// Whole rows are XORed at once, rows below the screen and columns past the right edge are clipped.
+	// VF is 1 when a pixel has been changed from set to unset.
+	c.V[0xF] = c.GFX.blit(x, y, sprite, height) ? 1 : 0;
+	c.DrawFlag = true;
+	c.PC += 2;
+}
+
+void chip8::opEX9E(chip8& c, const chip8Instruction& in)
+{
+	// EX9E: Skips the next instruction if the key stored in VX is pressed. (Usually the next instruction is a jump to skip a code block)
+	if (c.Key[c.V[in.X] & 0xF] == 1)
+		c.PC += 4;
+	else
+		c.PC += 2;
+}
+
+void chip8::opEXA1(chip8& c, const chip8Instruction& in)
+{
+	// EXA1: Skips the next instruction if the key stored in VX isn't pressed. (Usually the next instruction is a jump to skip a code block)
+	if (c.Key[c.V[in.X] & 0xF] == 0)
+		c.PC += 4;
+	else
+		c.PC += 2;
+}
 
-				default:
-					printf("Unknown opcode: 0x%X\n", OPCode);
+void chip8::opFX07(chip8& c, const chip8Instruction& in)
+{
+	// FX07: Sets VX to the value of the delay timer.
+	c.V[in.X] = c.DelayTimer;
+	c.PC += 2;
+}
+
+void chip8::opFX0A(chip8& c, const chip8Instruction& in)
+{
+	// FX0A: A key press is awaited, and then stored in VX. (Blocking Operation. All instruction halted until next key event)
+	// Like on the COSMAC VIP the key counts once it's released, a key still held from this wait
+	// doesn't go through the next FX0A straight away.
+	// PC doesn't advance until then so this instruction runs again next cycle.
+	if (c.WaitKey == 0xFF)
+	{
+		for (int i = 0; i < 16; ++i)
+		{
+			if (c.Key[i] != 0)
+			{
+				c.WaitKey = (uint8_t)i;
+				break;
 			}
-			break;
-		default:
-			printf("Unknown opcode: 0x%X\n", OPCode);
+		}
+		return;
 	}
 
-	// Update timers
-	if (DelayTimer > 0)
-		DelayTimer--;
+	if (c.Key[c.WaitKey] != 0)
+		return;
 
-	if (SoundTimer > 0)
-	{
-		if (SoundTimer == 1)
-			printf("BEEP!\n");
-		SoundTimer--;
+	c.V[in.X] = c.WaitKey;
+	c.WaitKey = 0xFF;
+	c.PC += 2;
+}
+
+void chip8::opFX15(chip8& c, const chip8Instruction& in)
+{
+	// FX15: Sets the delay timer to VX.
+	c.DelayTimer = c.V[in.X];
+	c.PC += 2;
+}
+
+void chip8::opFX18(chip8& c, const chip8Instruction& in)
+{
+	// FX18: Sets the sound timer to VX.
+	c.SoundTimer = c.V[in.X];
+	c.PC += 2;
+}
+
+void chip8::opFX1E(chip8& c, const chip8Instruction& in)
+{
+	// FX1E: Adds VX to I. VF is set to 1 when there is a range overflow (I+VX>0xFFF), and to 0 when there isn't.
+	if (c.I + c.V[in.X] > 0x0FFF)
+		c.V[0xF] = 1;
+	else
+		c.V[0xF] = 0;
+
+	c.I = c.I + c.V[in.X];
+	c.PC += 2;
+}
+
+void chip8::opFX29(chip8& c, const chip8Instruction& in)
+{
+	// FX29: Sets I to the location of the sprite for the character in VX. Characters 0-F (in hexadecimal) are represented by a 4x5 font.
+	c.I = c.V[in.X] * 0x5; //The sprites are 5 bytes long therefore we need to implement a 0x5 offset to find each char
+	c.PC += 2;
+}
+
+void chip8::opFX33(chip8& c, const chip8Instruction& in)
+{
+	// FX33: Stores the binary-coded decimal representation of VX, with the most significant of three digits at the address in I, the middle digit at I plus 1,
+	// and the least significant digit at I plus 2. 
+	//(In other words, take the decimal representation of VX, place the hundreds digit in memory at location in I,
+	//the tens digit at location I+1, and the ones digit at location I+2.)
+	c.writeMemory(c.I, c.V[in.X] / 100); //Get the most significant digit
+	c.writeMemory(c.I + 1, (c.V[in.X] / 10) % 10);   //Get the middle digit
+	c.writeMemory(c.I + 2, (c.V[in.X] % 100) % 10);   //Get the least significant digit
+	c.PC += 2;
+}
+
+void chip8::opFX55(chip8& c, const chip8Instruction& in)
+{
+	// FX55: Stores V0 to VX (including VX) in memory starting at address I. The offset from I is increased by 1 for each value written, but I itself is left unmodified.
+	for (int i = 0; i <= in.X; i++)
+		c.writeMemory(c.I + i, c.V[i]);
+	// On the original CHIP-8 and CHIP-48, when the operation is done, I = I + X + 1.
+	c.I += in.X + 1;
+	c.PC += 2;
+}
+
+void chip8::opFX65(chip8& c, const chip8Instruction& in)
+{
+	// FX65: Fills V0 to VX (including VX) with values from memory starting at address I.
+	for (int i = 0; i <= in.X; i++) {
+		c.V[i] = c.Memory[(c.I + i) & 0x0FFF];
 	}
+	// On the original CHIP-8 and CHIP-48, when the operation is done, I = I + X + 1.
+	c.I += in.X + 1;
+	c.PC += 2;
+}
+
+void chip8::unknownOpcode()
+{
+	Tracer.record(TraceLevel::Error, TRACE_CPU, CycleCount, PC, OPCode, I);
+
+	// PC doesn't move on an unknown opcode, so only report it the first time we get stuck on it
+	if (PC != UnknownPC)
+		printf("Unknown opcode: 0x%X\n", OPCode);
+	UnknownPC = PC;
 }
 
 bool chip8::loadApplication(const char* filename)
 {
 	printf("Loading: %s\n", filename);
 
-	// Open file in binary mode
-	FILE* pFile;
-	fopen_s(&pFile, filename, "rb");
-	if (pFile == NULL)
+	// The file is mapped and copied straight into memory, no buffer in between
+	chip8RomFile file;
+	if (!file.open(filename))
 	{
-		fputs("File error", stderr);
+		fputs("File error\n", stderr);
 		return false;
 	}
+	printf("Filesize: %zu\n", file.size());
 
-	// Check file size
-	fseek(pFile, 0, SEEK_END); // Move pointer to the end of the file
-	long fileByteSize = ftell(pFile); //Number of bytes since the beginning of the file
-	rewind(pFile); //Get back to the beginning of the file
-	printf("Filesize: %d\n", (int)fileByteSize);
+	return loadApplication(file.data(), file.size());
+}
 
+bool chip8::loadApplication(const uint8_t* data, size_t size)
+{
 	//Check if 8 Chip is able to load the program
-	if (fileByteSize > WORKING_RAM_MAX_AMOUNT) {
-		printf("Error: ROM too big for memory");
-	}
-
-	// Allocate memory to contain the whole file
-	uint8_t* buffer = (uint8_t*)malloc(sizeof(uint8_t) * fileByteSize);
-	if (buffer == NULL)
+	if (size > WORKING_RAM_MAX_AMOUNT)
 	{
-		fputs("Memory error", stderr);
+		fputs("Error: ROM too big for memory\n", stderr);
 		return false;
 	}
 
-	// Copy the file into the buffer
-	size_t result = fread(buffer, 1, fileByteSize, pFile);
-	if (result != fileByteSize)
-	{
-		fputs("Reading error", stderr);
-		return false;
-	}
+	flushCode(); // Code that was translated before is gone
+	Memory.write(PC, data, size);
 
-	// Copy buffer to Chip8 memory
-	memcpy(&Memory[PC], buffer, sizeof(uint8_t) * fileByteSize); //We need to use uint8_t * fileByteSize
-																 //because buffer is a pointer to the compiler it is the same as a pointer to a single element	
-	
-	// Close file, free buffer
-	fclose(pFile);
-	free(buffer);
+	// Save states only store the memory that changed since now
+	Image = Memory;
+	ImageHash = hashMemory(Image);
 
 	return true;
 }
 
+void chip8::loadImage(const chip8Memory& image, uint64_t imageHash)
+{
+	flushCode();
+
+	// Every page stays shared with image until the program writes to it
+	Memory = image;
+	Image = image;
+	ImageHash = imageHash;
+}
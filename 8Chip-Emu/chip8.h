@@ -1,5 +1,12 @@
 #pragma once
 #include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "trace.h"
+#include "profile.h"
+#include "framebuffer.h"
+#include "pagedmemory.h"
 // Memory map of the 8 bit chip
 // 0x000 - 0x1FF - Chip 8 interpreter(contains font set in emu)
 // 0x050 - 0x0A0 - Used for the built in 4x5 pixel font set(0 - F)
@@ -7,6 +14,89 @@
 
 #define WORKING_RAM_MAX_AMOUNT 3584
 
+// Idle loop skipping (see chip8::skipIdle)
+#define IDLE_CHECK_INTERVAL 1024	// Instructions between two looks for an idle loop
+#define IDLE_MAX_LOOP 16			// Longest loop, in instructions, that is recognized
+
+class chip8;
+class chip8BlockCache;
+class chip8Jit;
+struct chip8Block;
+
+// What an instruction does besides plain register work, used to find where blocks end
+enum chip8InstructionFlags : uint8_t
+{
+	INSTR_BRANCH  = 0x01,	// May not continue at PC + 2 (jumps, calls, returns and skips)
+	INSTR_DRAW    = 0x02,	// Changes GFX
+	INSTR_STORE   = 0x04,	// Writes to Memory
+	INSTR_TIMER   = 0x08,	// Reads or sets a timer
+	INSTR_WAIT    = 0x10,	// Waits for a key
+	INSTR_UNKNOWN = 0x20,	// Not a valid opcode
+
+	INSTR_ENDS_BLOCK = INSTR_BRANCH | INSTR_DRAW | INSTR_STORE | INSTR_WAIT | INSTR_UNKNOWN	// Timers only change between frames
+};
+
+// Which instruction an opcode is, lets engines call a handler directly instead of through Handler
+enum chip8Op : uint8_t
+{
+	OP_UNKNOWN,
+	OP_00E0,
+	OP_00EE,
+	OP_1NNN,
+	OP_2NNN,
+	OP_3XNN,
+	OP_4XNN,
+	OP_5XY0,
+	OP_6XNN,
+	OP_7XNN,
+	OP_8XY0,
+	OP_8XY1,
+	OP_8XY2,
+	OP_8XY3,
+	OP_8XY4,
+	OP_8XY5,
+	OP_8XY6,
+	OP_8XY7,
+	OP_8XYE,
+	OP_9XY0,
+	OP_ANNN,
+	OP_BNNN,
+	OP_CXNN,
+	OP_DXYN,
+	OP_EX9E,
+	OP_EXA1,
+	OP_FX07,
+	OP_FX0A,
+	OP_FX15,
+	OP_FX18,
+	OP_FX1E,
+	OP_FX29,
+	OP_FX33,
+	OP_FX55,
+	OP_FX65
+};
+
+// An opcode decoded ahead of time: the handler that executes it and its operand fields
+struct chip8Instruction
+{
+	void (*Handler)(chip8&, const chip8Instruction&);
+	uint16_t NNN;	// Address
+	uint8_t  X;		// First register
+	uint8_t  Y;		// Second register
+	uint8_t  NN;	// 8 bit constant
+	uint8_t  N;		// 4 bit constant
+	uint8_t  Flags;	// chip8InstructionFlags
+	uint8_t  Op;	// chip8Op
+};
+
+// How run() executes instructions
+enum class chip8Engine
+{
+	Interpreter,	// One emulateCycle per instruction
+	BlockCache,		// Cached straight-line blocks of pre-decoded instructions (see blockcache.h)
+	Jit				// Block cache with hot blocks compiled to native code (see jit.h)
+};
+
 class chip8
 {
 	public:
@@ -17,24 +107,179 @@ class chip8
 
 		void debugRender();
 		void emulateCycle();
+		void emulateCycleSwitch();
 		bool loadApplication(const char* filename);
+		bool loadApplication(const uint8_t* data, size_t size);
+
+		// Memory right after loadApplication and its hash (see snapshot.h). loadImage loads the same
+		// program again by sharing the pages of image, which is what chip8RomIndex does for ROMs it
+		// has seen before.
+		const chip8Memory& getImage() const { return Image; }
+		uint64_t getImageHash() const { return ImageHash; }
+		void loadImage(const chip8Memory& image, uint64_t imageHash);
+
+		// Execute up to cycles instructions with the selected engine, returns how many were executed.
+		// Stops early once DrawFlag is set so the caller can present the frame.
+		uint64_t run(uint64_t cycles);
+
+		// Programs waiting for the delay timer or a key spin in a loop that changes nothing until the
+		// timers tick or the keys change, which only happens between run() calls. run() recognizes
+		// these loops and counts their instructions as executed without running them, the machine
+		// ends in exactly the same state either way. On by default, never in trace builds.
+		void setIdleSkip(bool skip) { IdleSkip = skip; }
+		uint64_t getIdleCycles() const { return IdleCycles; }	// Instructions skipped so far
+
+		// Count the delay and sound timers down by one, called at 60 Hz by the scheduler (see scheduler.h)
+		void tickTimers();
+
+		void setEngine(chip8Engine engine);
+		chip8Engine getEngine() const { return Engine; }
+		const chip8BlockCache* getBlockCache() const { return Blocks.get(); }
+		const chip8Jit* getJit() const { return Jit.get(); }
+
+		// Save states (see snapshot.h). A delta snapshot only stores the memory that differs from
+		// the loaded ROM and can only be restored into a machine that loaded the same ROM.
+		// restore returns false and leaves the machine alone when the data can't be used.
+		void snapshot(std::vector<uint8_t>& out, bool delta = true) const;
+		bool restore(const uint8_t* data, size_t size);
+
+		// Become a copy of parent. The memory pages are shared until one of the two writes to them,
+		// so a fork costs about as much as copying the registers (see pagedmemory.h).
+		void forkFrom(const chip8& parent);
+		int sharedPages() const { return Memory.sharedPages(); }	// Memory pages still shared with forks or the ROM image
+
+		// Compare the whole machine state with another instance
+		bool sameState(const chip8& other) const;
+
+		uint64_t getCycleCount() const { return CycleCount; }
+
+		// CXNN random numbers come from a generator owned by each machine, the same seed always gives
+		// the same numbers so runs can be replayed. Machines get a different seed every time by default.
+		void seedRandom(uint64_t seed);
+		uint64_t getRandomState() const { return RandomState; }	// Snapshot of the generator...
+		void setRandomState(uint64_t state);						// ...to continue from later
+
+		// Decode a single opcode, used to build the decode table
+		static chip8Instruction decode(uint16_t opcode);
+
+		// Display for renderers, one bit per pixel (see framebuffer.h)
+		const chip8Framebuffer& getFramebuffer() const { return GFX; }
+
+		// Part of the screen 00E0 and DXYN changed since the last call, renderers upload just that
+		chip8DirtyRegion takeDirtyRegion() { return GFX.takeDirty(); }
+
+		// Set every key at once, bit n of keys is key n
+		void setKeys(uint16_t keys)
+		{
+			for (int k = 0; k < 16; k++)
+				Key[k] = keys >> k & 1;
+		}
+		uint16_t getKeys() const
+		{
+			uint16_t keys = 0;
+			for (int k = 0; k < 16; k++)
+				keys |= (uint16_t)((Key[k] != 0) << k);
+			return keys;
+		}
+
+		// True when the machine sits in FX0A and nothing but a change of the keys can move it on:
+		// no key is down, or the key it took is still held, and both timers are stopped. Hosts can
+		// sleep until the next key event instead of running frames that change nothing.
+		bool waitingForKey() const;
 
 		// Chip8
-		uint16_t  GFX[64 * 32];	// Total amount of pixels: 2048 //VRAM
 		uint16_t  Key[16];
 
+		// Opcode trace, compiled out unless CHIP8_TRACE is set (see trace.h)
+		Trace Tracer;
+
+		// Instruction profile, compiled out unless CHIP8_PROFILE is set (see profile.h)
+		Profile Profiler;
+
 	private:
 		uint16_t PC;		// Program counter
 		uint16_t OPCode;	// Current opcode
 		uint16_t I;		// Index register
 		uint16_t SP;		// Stack pointer
 
+		chip8Framebuffer GFX;	// VRAM, 64x32 pixels packed in 32 words
+
 		uint8_t  V[16];			// V-regs (V0-VF)
 		uint16_t Stack[16];		// Stack (16 levels)
-		uint8_t  Memory[4096];	// Memory (size = 4k)		
+		chip8Memory Memory;		// Memory (size = 4k) in copy-on-write pages
 
 		uint8_t  DelayTimer;	// Delay timer
 		uint8_t  SoundTimer;	// Sound timer		
 
+		uint64_t CycleCount;	// Instructions executed since init
+		uint64_t RandomState;	// xorshift64* state, never 0
+		uint16_t UnknownPC;		// Where the last unknown opcode was reported
+		uint8_t WaitKey;		// Key pressed during FX0A, stored once it's released. 0xFF before that.
+		bool IdleSkip;
+		uint64_t IdleCycles;
+		uint16_t IdlePC;		// PC at the last look for an idle loop
+
+		const chip8Instruction* DecodeTable;	// Shared table indexed by opcode
+
+		chip8Memory Image;		// Memory right after init or loadApplication, shares the unchanged pages
+		uint64_t ImageHash;
+
+		chip8Engine Engine;
+		std::unique_ptr<chip8BlockCache> Blocks;	// Only allocated for the block cache and JIT engines
+		std::unique_ptr<chip8Jit> Jit;				// Only allocated for the JIT engine
+
 		void init();
+		void unknownOpcode();
+		uint64_t runBlocks(uint64_t cycles);
+		uint64_t skipIdle(uint64_t cycles);
+		void executeBlock(chip8Block& block);
+		void flushCode();
+		void execute(const chip8Instruction& in);
+		uint8_t nextRandom();
+
+		// Every write to Memory made by an instruction goes through here so cached code stays valid
+		void writeMemory(uint16_t address, uint8_t value);
+
+		static const chip8Instruction* decodeTable();
+		static uint64_t hashMemory(const chip8Memory& memory);
+
+		// Opcode handlers
+		static void opUnknown(chip8& c, const chip8Instruction& in);
+		static void op00E0(chip8& c, const chip8Instruction& in);
+		static void op00EE(chip8& c, const chip8Instruction& in);
+		static void op1NNN(chip8& c, const chip8Instruction& in);
+		static void op2NNN(chip8& c, const chip8Instruction& in);
+		static void op3XNN(chip8& c, const chip8Instruction& in);
+		static void op4XNN(chip8& c, const chip8Instruction& in);
+		static void op5XY0(chip8& c, const chip8Instruction& in);
+		static void op6XNN(chip8& c, const chip8Instruction& in);
+		static void op7XNN(chip8& c, const chip8Instruction& in);
+		static void op8XY0(chip8& c, const chip8Instruction& in);
+		static void op8XY1(chip8& c, const chip8Instruction& in);
+		static void op8XY2(chip8& c, const chip8Instruction& in);
+		static void op8XY3(chip8& c, const chip8Instruction& in);
+		static void op8XY4(chip8& c, const chip8Instruction& in);
+		static void op8XY5(chip8& c, const chip8Instruction& in);
+		static void op8XY6(chip8& c, const chip8Instruction& in);
+		static void op8XY7(chip8& c, const chip8Instruction& in);
+		static void op8XYE(chip8& c, const chip8Instruction& in);
+		static void op9XY0(chip8& c, const chip8Instruction& in);
+		static void opANNN(chip8& c, const chip8Instruction& in);
+		static void opBNNN(chip8& c, const chip8Instruction& in);
+		static void opCXNN(chip8& c, const chip8Instruction& in);
+		static void opDXYN(chip8& c, const chip8Instruction& in);
+		static void opEX9E(chip8& c, const chip8Instruction& in);
+		static void opEXA1(chip8& c, const chip8Instruction& in);
+		static void opFX07(chip8& c, const chip8Instruction& in);
+		static void opFX0A(chip8& c, const chip8Instruction& in);
+		static void opFX15(chip8& c, const chip8Instruction& in);
+		static void opFX18(chip8& c, const chip8Instruction& in);
+		static void opFX1E(chip8& c, const chip8Instruction& in);
+		static void opFX29(chip8& c, const chip8Instruction& in);
+		static void opFX33(chip8& c, const chip8Instruction& in);
+		static void opFX55(chip8& c, const chip8Instruction& in);
+		static void opFX65(chip8& c, const chip8Instruction& in);
+
+		friend class chip8Jit; // Generated code works directly on V, I and PC
+		friend class chip8Batch; // Keeps the registers of many machines side by side (see batch.h)
 };
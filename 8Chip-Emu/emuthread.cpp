@@ -0,0 +1,162 @@
+#include "emuthread.h"
+
+chip8EmuThread::chip8EmuThread(chip8& machine, chip8Scheduler& scheduler, void (*onFrame)())
+	: Machine(machine), Scheduler(scheduler), OnFrame(onFrame), Running(false), Keys(0), Rewinding(false), Turbo(false), TurboSkip(0), Waiting(false)
+{
+	LastDirty.Rows = 0;
+	LastDrew = false;
+	SkippedDirty.Rows = 0;
+	SkippedDrew = false;
+	Movie = NULL;
+	Recording = false;
+}
+
+chip8EmuThread::~chip8EmuThread()
+{
+	stop();
+}
+
+void chip8EmuThread::setMovie(chip8Movie* movie, bool recording)
+{
+	Movie = movie;
+	Recording = recording;
+	Scheduler.play(movie != NULL && !recording ? movie : NULL);
+}
+
+void chip8EmuThread::start()
+{
+	if (Running)
+		return;
+
+	Running = true;
+	Scheduler.resync();
+	Thread = std::thread(&chip8EmuThread::run, this);
+}
+
+void chip8EmuThread::stop()
+{
+	Running = false;
+	wake();
+	if (Thread.joinable())
+		Thread.join();
+}
+
+void chip8EmuThread::wake()
+{
+	// Taking the lock makes sure the thread is either not checking yet or already asleep
+	std::lock_guard<std::mutex> lock(WakeMutex);
+	Wake.notify_one();
+}
+
+void chip8EmuThread::waitForKeys(uint16_t keys)
+{
+	std::unique_lock<std::mutex> lock(WakeMutex);
+	Waiting.store(true, std::memory_order_relaxed);
+	Wake.wait(lock, [&] {
+		return !Running.load(std::memory_order_relaxed) || Rewinding.load(std::memory_order_relaxed) || Keys.load(std::memory_order_relaxed) != keys;
+	});
+	Waiting.store(false, std::memory_order_relaxed);
+}
+
+void chip8EmuThread::run()
+{
+	bool paced = true;
+	while (Running.load(std::memory_order_relaxed))
+	{
+		bool rewound = false;
+		bool ran = false;
+		if (Movie == NULL && Rewinding.load(std::memory_order_relaxed))
+		{
+			// Go back a frame, restoring marks the whole screen dirty. At the oldest frame it stays there.
+			rewound = History.rewind(Machine, 1) > 0;
+		}
+		else
+		{
+			// A replayed movie sets the keys itself
+			if (Movie == NULL || Recording)
+				Machine.setKeys(Keys.load(std::memory_order_relaxed));
+			if (Movie != NULL && Recording)
+				Movie->record(Machine);
+
+			Scheduler.runFrame();
+			ran = true;
+		}
+
+		// Only keys from the host can end the wait, a replayed movie sets them at exact cycles
+		const bool waiting = ran && (Movie == NULL || Recording) && Machine.waitingForKey();
+
+		chip8DirtyRegion dirty = Machine.takeDirtyRegion();
+		bool drew = Machine.DrawFlag || rewound;
+		Machine.DrawFlag = false;
+
+		// Frames that aren't published still have to be uploaded with the next one that is
+		dirty.add(SkippedDirty);
+		drew = drew || SkippedDrew;
+
+		const bool turbo = Turbo.load(std::memory_order_relaxed);
+		if (turbo)
+		{
+			const int skip = TurboSkip.load(std::memory_order_relaxed);
+			if (!waiting && (skip > 0 ? Scheduler.Frames % skip != 0 : Frames.unread()))
+			{
+				SkippedDirty = dirty;
+				SkippedDrew = drew;
+				paced = false;
+				continue;
+			}
+		}
+		SkippedDirty.Rows = 0;
+		SkippedDrew = false;
+
+		// In turbo mode only the frames that are shown go to the history, it would last seconds otherwise
+		if (ran && Movie == NULL)
+			History.push(Machine);
+
+		// The render thread only sees the frames it picks up, whatever the last published frame changed
+		// has to be uploaded with this one if it was skipped. If it gets picked up right after the
+		// check the render thread just uploads a bit more than it needs to.
+		if (Frames.unread())
+		{
+			dirty.add(LastDirty);
+			drew = drew || LastDrew;
+		}
+
+		chip8FrameData& frame = Frames.back();
+		frame.GFX = Machine.getFramebuffer();
+		frame.Dirty = dirty;
+		frame.Drew = drew;
+		frame.Frame = Scheduler.Frames;
+		frame.Cycles = Machine.getCycleCount();
+		Frames.publish();
+
+		LastDirty = dirty;
+		LastDrew = drew;
+
+		if (OnFrame != NULL)
+			OnFrame();
+
+		// The frame the game waits on is shown, then nothing happens until a key does. Frames don't
+		// count while asleep, the machine would have been in exactly the same state at every one.
+		if (waiting)
+		{
+			waitForKeys(Machine.getKeys());
+			Scheduler.resync();
+			paced = true;
+			continue;
+		}
+
+		if (turbo)
+		{
+			paced = false;
+			continue;
+		}
+
+		// Coming out of turbo mode the schedule starts over from now
+		if (!paced)
+		{
+			Scheduler.resync();
+			paced = true;
+		}
+		Scheduler.waitForFrame();
+	}
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "chip8.h"
+#include "scheduler.h"
+#include "triplebuffer.h"
+#include "rewind.h"
+#include "movie.h"
+
+// Runs a chip8 machine on its own thread
+// The thread runs the scheduler's 60 Hz frame loop and publishes every completed frame through a
+// triple buffer, so the render thread can take the newest one whenever it is ready and a slow swap
+// or a window being dragged around never holds up the emulation. Keys go the other way as an
+// atomic bitmask the emulation thread applies at the start of every frame.
+// Every frame is also pushed to a rewind history, while rewinding is held the thread steps back
+// through it one frame at a time instead of running the machine.
+// With a movie the keys are either recorded into it or come from it instead of the keyboard.
+// In turbo mode the frames run back to back as fast as the core goes and only some of them are
+// published, either every Nth one or whenever the render thread has picked up the previous one.
+// While the game waits in FX0A for a key and nothing else can change, the thread sleeps until a
+// key event comes in instead of running frames.
+
+// A completed frame as seen by the render thread
+struct chip8FrameData
+{
+	chip8Framebuffer GFX;
+	chip8DirtyRegion Dirty;		// Changed since the previous frame the render thread picked up
+	bool Drew;					// Any instruction drew since then
+	uint64_t Frame;				// Emulated frames completed so far
+	uint64_t Cycles;			// Instructions executed so far
+};
+
+class chip8EmuThread
+{
+	public:
+		// onFrame is called on the emulation thread after every published frame, for example to wake
+		// up a render thread sleeping in glfwWaitEvents. It may be NULL.
+		chip8EmuThread(chip8& machine, chip8Scheduler& scheduler, void (*onFrame)() = NULL);
+		~chip8EmuThread();
+
+		// Record the keys into movie, or replay it. Call before start, rewinding is ignored with a
+		// movie since it would take the machine to a point the scheduler's frames don't match.
+		void setMovie(chip8Movie* movie, bool recording);
+
+		void start();
+		void stop();	// Waits for the frame in progress to finish
+
+		// Key state, safe to call from any thread
+		void pressKey(int key) { Keys.fetch_or((uint16_t)(1 << key), std::memory_order_relaxed); wake(); }
+		void releaseKey(int key) { Keys.fetch_and((uint16_t)~(1 << key), std::memory_order_relaxed); wake(); }
+		void setRewinding(bool rewinding) { Rewinding.store(rewinding, std::memory_order_relaxed); wake(); }
+
+		// The emulation is asleep until a key changes (see chip8::waitingForKey)
+		bool waiting() const { return Waiting.load(std::memory_order_relaxed); }
+
+		// Turbo mode, safe to call from any thread. With skip 0 a frame is published whenever the
+		// render thread took the previous one, otherwise every skip frames. Either way the render
+		// thread's presenter keeps the presents to the host refresh rate.
+		void setTurbo(bool turbo) { Turbo.store(turbo, std::memory_order_relaxed); }
+		bool turbo() const { return Turbo.load(std::memory_order_relaxed); }
+		void setTurboSkip(int skip) { TurboSkip.store(skip > 0 ? skip : 0, std::memory_order_relaxed); }
+
+		// Render thread: pick up the newest frame, false when none was completed since the last call
+		bool update() { return Frames.update(); }
+		const chip8FrameData& frame() const { return Frames.front(); }
+
+	private:
+		chip8& Machine;
+		chip8Scheduler& Scheduler;
+		void (*OnFrame)();
+
+		std::thread Thread;
+		std::atomic<bool> Running;
+		std::atomic<uint16_t> Keys;		// Bit n is key n
+		std::atomic<bool> Rewinding;
+		std::atomic<bool> Turbo;
+		std::atomic<int> TurboSkip;
+		std::atomic<bool> Waiting;
+		std::mutex WakeMutex;			// Only guards the sleep in waitForKeys against missed wakeups
+		std::condition_variable Wake;
+		chip8Rewind History;			// Only touched by the emulation thread
+		chip8Movie* Movie;
+		bool Recording;
+
+		chip8TripleBuffer<chip8FrameData> Frames;
+		chip8DirtyRegion LastDirty;		// What the last published frame changed
+		bool LastDrew;
+		chip8DirtyRegion SkippedDirty;	// What the frames turbo mode didn't publish changed
+		bool SkippedDrew;
+
+		void run();
+		void wake();
+		void waitForKeys(uint16_t keys);	// Sleep until the keys differ from keys, rewinding or stop
+};
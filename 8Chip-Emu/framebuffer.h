@@ -0,0 +1,142 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include "gfxsimd.h"
+
+// Bit-packed monochrome framebuffer for the chip8 display
+// Every pixel is a single bit, a row is GFX_ROW_WORDS 64 bit words with the leftmost pixel in the
+// most significant bit, the same order as the bits of a sprite byte. That way a sprite row is
+// drawn with a shift and an XOR, and the 64x32 screen is 256 bytes (4 cache lines) instead of 4 KB.
+// The size is fixed at compile time, a bigger mode only needs GFX_WIDTH and GFX_HEIGHT changed.
+// Whole screen operations run through the SIMD kernels picked for this CPU (see gfxsimd.h).
+// Every change also grows a dirty region so renderers can upload only what was drawn since they last looked.
+
+#define GFX_WIDTH 64
+#define GFX_HEIGHT 32
+#define GFX_ROW_WORDS ((GFX_WIDTH + 63) / 64)	// 64 bit words per row
+#define GFX_ALL_ROWS (GFX_HEIGHT == 64 ? ~0ULL : (1ULL << GFX_HEIGHT) - 1)
+
+// Part of the screen changed since the last chip8::takeDirtyRegion
+struct chip8DirtyRegion
+{
+	uint64_t Rows;		// Bit y is set for every row that changed
+	int Left, Right;	// First and last column that changed, only meaningful when Rows != 0
+
+	bool empty() const { return Rows == 0; }
+
+	// Grow to also cover other
+	void add(const chip8DirtyRegion& other)
+	{
+		if (other.Rows == 0)
+			return;
+
+		if (Rows == 0)
+		{
+			Left = other.Left;
+			Right = other.Right;
+		}
+		else
+		{
+			Left = other.Left < Left ? other.Left : Left;
+			Right = other.Right > Right ? other.Right : Right;
+		}
+		Rows |= other.Rows;
+	}
+};
+
+class chip8Framebuffer
+{
+	public:
+		chip8Framebuffer()
+		{
+			Dirty.Rows = 0;
+			clear();
+		}
+
+		static int width() { return GFX_WIDTH; }
+		static int height() { return GFX_HEIGHT; }
+
+		void clear()
+		{
+			gfxActiveKernels().Clear(Rows[0]);
+			markDirty(GFX_ALL_ROWS, 0, GFX_WIDTH - 1);
+		}
+
+		// True when the pixel at (x, y) is lit, both coordinates must be on the screen
+		bool pixel(int x, int y) const
+		{
+			return (Rows[y][x / 64] >> (63 - x % 64) & 1) != 0;
+		}
+
+		// FNV-1a over the pixel values (0 or 1) row after row, it doesn't depend on how they are
+		// stored so the hashes printed by the tools and kept in ROM archives stay valid
+		uint64_t hash() const
+		{
+			uint64_t hash = 0xcbf29ce484222325ULL;
+			for (int y = 0; y < GFX_HEIGHT; y++)
+				for (int x = 0; x < GFX_WIDTH; x++)
+				{
+					hash ^= pixel(x, y) ? 1 : 0;
+					hash *= 0x100000001b3ULL;
+				}
+
+			return hash;
+		}
+
+		// The words of row y, pixel x is bit 63 - (x % 64) of word x / 64
+		const uint64_t* row(int y) const { return Rows[y]; }
+
+		// Replace the whole picture with GFX_HEIGHT * GFX_ROW_WORDS words, row after row (save states)
+		void setRows(const uint64_t* words)
+		{
+			memcpy(Rows, words, sizeof(Rows));
+			markDirty(GFX_ALL_ROWS, 0, GFX_WIDTH - 1);
+		}
+
+		// XOR height sprite bytes (8 pixels each) onto the rows starting at (x, y), which must be on
+		// the screen. Anything past the right or bottom edge is clipped. Returns true when a lit pixel
+		// was turned off (the chip8 collision flag).
+		bool blit(int x, int y, const uint8_t* sprite, int height)
+		{
+			// Rows and columns the clipped sprite covers
+			const int last = y + height < GFX_HEIGHT ? y + height : GFX_HEIGHT;
+			const uint64_t rows = (last - y == 64 ? ~0ULL : (1ULL << (last - y)) - 1) << y;
+			markDirty(rows, x, x + 7 < GFX_WIDTH ? x + 7 : GFX_WIDTH - 1);
+
+			return gfxActiveKernels().Blit(Rows[0], x, y, sprite, height);
+		}
+
+		// Bit y is set for every row that differs from other, renderers use it to find what changed
+		uint64_t diffRows(const chip8Framebuffer& other) const
+		{
+			return gfxActiveKernels().DiffRows(Rows[0], other.Rows[0]);
+		}
+
+		// Scroll the picture, the area left behind is cleared
+		void scrollDown(int n) { gfxActiveKernels().ScrollDown(Rows[0], n); markDirty(GFX_ALL_ROWS, 0, GFX_WIDTH - 1); }
+		void scrollLeft(int n) { gfxActiveKernels().ScrollLeft(Rows[0], n); markDirty(GFX_ALL_ROWS, 0, GFX_WIDTH - 1); }
+		void scrollRight(int n) { gfxActiveKernels().ScrollRight(Rows[0], n); markDirty(GFX_ALL_ROWS, 0, GFX_WIDTH - 1); }
+
+		// Region changed since the last call, which starts a new empty one
+		chip8DirtyRegion takeDirty()
+		{
+			const chip8DirtyRegion region = Dirty;
+			Dirty.Rows = 0;
+			return region;
+		}
+
+		bool operator==(const chip8Framebuffer& other) const
+		{
+			return gfxActiveKernels().Equal(Rows[0], other.Rows[0]);
+		}
+
+	private:
+		uint64_t Rows[GFX_HEIGHT][GFX_ROW_WORDS];
+		chip8DirtyRegion Dirty;
+
+		void markDirty(uint64_t rows, int left, int right)
+		{
+			const chip8DirtyRegion region = { rows, left, right };
+			Dirty.add(region);
+		}
+};
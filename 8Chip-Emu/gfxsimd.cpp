@@ -0,0 +1,456 @@
+#include "gfxsimd.h"
+#include "framebuffer.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define GFX_SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define GFX_SIMD_X86 0
+#endif
+
+// The vector kernels only know about one word per row
+#if GFX_SIMD_X86 && GFX_ROW_WORDS == 1
+#define GFX_SIMD_KERNELS 1
+#else
+#define GFX_SIMD_KERNELS 0
+#endif
+
+// GCC and Clang only emit AVX2 instructions in functions that ask for them, MSVC always does
+#if defined(_MSC_VER) && !defined(__clang__)
+#define GFX_TARGET_SSE2
+#define GFX_TARGET_AVX2
+#else
+#define GFX_TARGET_SSE2 __attribute__((target("sse2")))
+#define GFX_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#define GFX_WORDS (GFX_HEIGHT * GFX_ROW_WORDS)
+
+static_assert(GFX_HEIGHT <= 64, "DiffRows returns one bit per row");
+#if GFX_SIMD_KERNELS
+static_assert(GFX_WORDS % 4 == 0, "The vector kernels work on groups of four rows");
+#endif
+
+// Scalar kernels, the reference for the others and the only ones for wide screens
+
+static void clearScalar(uint64_t* rows)
+{
+	memset(rows, 0, GFX_WORDS * sizeof(uint64_t));
+}
+
+static bool blitScalar(uint64_t* rows, int x, int y, const uint8_t* sprite, int height)
+{
+	const int word = x / 64;
+	const int shift = x % 64;
+	uint64_t collision = 0;
+
+	if (height > GFX_HEIGHT - y)
+		height = GFX_HEIGHT - y;
+
+	for (int r = 0; r < height; r++)
+	{
+		uint64_t* row = rows + (y + r) * GFX_ROW_WORDS;
+
+		// Sprite bits lined up with the word the row starts in
+		const uint64_t bits = ((uint64_t)sprite[r] << 56) >> shift;
+		collision |= row[word] & bits;
+		row[word] ^= bits;
+
+		// With more than one word per row a sprite may continue into the next word
+		if (GFX_ROW_WORDS > 1 && shift > 56 && word + 1 < GFX_ROW_WORDS)
+		{
+			const uint64_t spill = (uint64_t)sprite[r] << (120 - shift);
+			collision |= row[word + 1] & spill;
+			row[word + 1] ^= spill;
+		}
+	}
+
+	return collision != 0;
+}
+
+static bool equalScalar(const uint64_t* a, const uint64_t* b)
+{
+	uint64_t difference = 0;
+	for (int w = 0; w < GFX_WORDS; w++)
+		difference |= a[w] ^ b[w];
+
+	return difference == 0;
+}
+
+static uint64_t diffRowsScalar(const uint64_t* a, const uint64_t* b)
+{
+	uint64_t changed = 0;
+
+	for (int y = 0; y < GFX_HEIGHT; y++)
+	{
+		uint64_t difference = 0;
+		for (int w = 0; w < GFX_ROW_WORDS; w++)
+			difference |= a[y * GFX_ROW_WORDS + w] ^ b[y * GFX_ROW_WORDS + w];
+
+		if (difference != 0)
+			changed |= 1ULL << y;
+	}
+
+	return changed;
+}
+
+static void scrollDownScalar(uint64_t* rows, int n)
+{
+	if (n <= 0)
+		return;
+	if (n > GFX_HEIGHT)
+		n = GFX_HEIGHT;
+
+	memmove(rows + n * GFX_ROW_WORDS, rows, (GFX_HEIGHT - n) * GFX_ROW_WORDS * sizeof(uint64_t));
+	memset(rows, 0, n * GFX_ROW_WORDS * sizeof(uint64_t));
+}
+
+static void scrollLeftScalar(uint64_t* rows, int n)
+{
+	if (n <= 0)
+		return;
+	if (n >= GFX_WIDTH)
+	{
+		clearScalar(rows);
+		return;
+	}
+
+	// Whole words first, then the bits that cross a word boundary
+	const int words = n / 64;
+	const int bits = n % 64;
+
+	for (int y = 0; y < GFX_HEIGHT; y++)
+	{
+		uint64_t* row = rows + y * GFX_ROW_WORDS;
+		for (int w = 0; w < GFX_ROW_WORDS; w++)
+		{
+			const uint64_t first = w + words < GFX_ROW_WORDS ? row[w + words] : 0;
+			const uint64_t second = w + words + 1 < GFX_ROW_WORDS ? row[w + words + 1] : 0;
+			row[w] = bits == 0 ? first : first << bits | second >> (64 - bits);
+		}
+	}
+}
+
+static void scrollRightScalar(uint64_t* rows, int n)
+{
+	if (n <= 0)
+		return;
+	if (n >= GFX_WIDTH)
+	{
+		clearScalar(rows);
+		return;
+	}
+
+	const int words = n / 64;
+	const int bits = n % 64;
+
+	for (int y = 0; y < GFX_HEIGHT; y++)
+	{
+		uint64_t* row = rows + y * GFX_ROW_WORDS;
+		for (int w = GFX_ROW_WORDS - 1; w >= 0; w--)
+		{
+			const uint64_t first = w - words >= 0 ? row[w - words] : 0;
+			const uint64_t second = w - words - 1 >= 0 ? row[w - words - 1] : 0;
+			row[w] = bits == 0 ? first : first >> bits | second << (64 - bits);
+		}
+	}
+}
+
+static const chip8GfxKernels ScalarKernels =
+{
+	"scalar",
+	clearScalar,
+	blitScalar,
+	equalScalar,
+	diffRowsScalar,
+	scrollDownScalar,
+	scrollLeftScalar,
+	scrollRightScalar
+};
+
+#if GFX_SIMD_KERNELS
+
+// SSE2 kernels, two rows per register
+
+GFX_TARGET_SSE2 static void clearSSE2(uint64_t* rows)
+{
+	const __m128i zero = _mm_setzero_si128();
+	for (int w = 0; w < GFX_WORDS; w += 2)
+		_mm_storeu_si128((__m128i*)(rows + w), zero);
+}
+
+GFX_TARGET_SSE2 static bool blitSSE2(uint64_t* rows, int x, int y, const uint8_t* sprite, int height)
+{
+	const __m128i shift = _mm_cvtsi32_si128(x);
+	__m128i collision = _mm_setzero_si128();
+	int r = 0;
+
+	if (height > GFX_HEIGHT - y)
+		height = GFX_HEIGHT - y;
+
+	for (; r + 2 <= height; r += 2)
+	{
+		// Both sprite bytes moved to the top of their lane, then to column x
+		__m128i bits = _mm_set_epi64x((int64_t)sprite[r + 1], (int64_t)sprite[r]);
+		bits = _mm_srl_epi64(_mm_slli_epi64(bits, 56), shift);
+
+		__m128i* row = (__m128i*)(rows + y + r);
+		const __m128i pixels = _mm_loadu_si128(row);
+		collision = _mm_or_si128(collision, _mm_and_si128(pixels, bits));
+		_mm_storeu_si128(row, _mm_xor_si128(pixels, bits));
+	}
+
+	bool collided = _mm_movemask_epi8(_mm_cmpeq_epi8(collision, _mm_setzero_si128())) != 0xFFFF;
+
+	// Odd row left over
+	if (r < height)
+		collided |= blitScalar(rows, x, y + r, sprite + r, 1);
+
+	return collided;
+}
+
+GFX_TARGET_SSE2 static bool equalSSE2(const uint64_t* a, const uint64_t* b)
+{
+	__m128i difference = _mm_setzero_si128();
+	for (int w = 0; w < GFX_WORDS; w += 2)
+		difference = _mm_or_si128(difference, _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + w)), _mm_loadu_si128((const __m128i*)(b + w))));
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(difference, _mm_setzero_si128())) == 0xFFFF;
+}
+
+GFX_TARGET_SSE2 static uint64_t diffRowsSSE2(const uint64_t* a, const uint64_t* b)
+{
+	uint64_t changed = 0;
+
+	for (int w = 0; w < GFX_WORDS; w += 2)
+	{
+		// SSE2 has no 64 bit compare, a row is unchanged when both of its 32 bit halves are
+		const __m128i same = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(a + w)), _mm_loadu_si128((const __m128i*)(b + w)));
+		const int mask = _mm_movemask_ps(_mm_castsi128_ps(same));
+
+		if ((mask & 0x3) != 0x3)
+			changed |= 1ULL << w;
+		if ((mask & 0xC) != 0xC)
+			changed |= 1ULL << (w + 1);
+	}
+
+	return changed;
+}
+
+GFX_TARGET_SSE2 static void scrollLeftSSE2(uint64_t* rows, int n)
+{
+	if (n <= 0)
+		return;
+
+	// Shift counts of 64 and more give 0, which is the cleared screen
+	const __m128i shift = _mm_cvtsi32_si128(n);
+	for (int w = 0; w < GFX_WORDS; w += 2)
+	{
+		__m128i* row = (__m128i*)(rows + w);
+		_mm_storeu_si128(row, _mm_sll_epi64(_mm_loadu_si128(row), shift));
+	}
+}
+
+GFX_TARGET_SSE2 static void scrollRightSSE2(uint64_t* rows, int n)
+{
+	if (n <= 0)
+		return;
+
+	const __m128i shift = _mm_cvtsi32_si128(n);
+	for (int w = 0; w < GFX_WORDS; w += 2)
+	{
+		__m128i* row = (__m128i*)(rows + w);
+		_mm_storeu_si128(row, _mm_srl_epi64(_mm_loadu_si128(row), shift));
+	}
+}
+
+static const chip8GfxKernels SSE2Kernels =
+{
+	"sse2",
+	clearSSE2,
+	blitSSE2,
+	equalSSE2,
+	diffRowsSSE2,
+	scrollDownScalar,	// A memmove of whole rows, already vectorized by the C library
+	scrollLeftSSE2,
+	scrollRightSSE2
+};
+
+// AVX2 kernels, four rows per register
+
+GFX_TARGET_AVX2 static void clearAVX2(uint64_t* rows)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	for (int w = 0; w < GFX_WORDS; w += 4)
+		_mm256_storeu_si256((__m256i*)(rows + w), zero);
+}
+
+GFX_TARGET_AVX2 static bool blitAVX2(uint64_t* rows, int x, int y, const uint8_t* sprite, int height)
+{
+	const __m128i shift = _mm_cvtsi32_si128(x);
+	__m256i collision = _mm256_setzero_si256();
+	int r = 0;
+
+	if (height > GFX_HEIGHT - y)
+		height = GFX_HEIGHT - y;
+
+	for (; r + 4 <= height; r += 4)
+	{
+		// Four sprite bytes widened to one per lane, moved to the top of the lane and then to column x
+		int32_t bytes;
+		memcpy(&bytes, sprite + r, sizeof(bytes));
+		__m256i bits = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(bytes));
+		bits = _mm256_srl_epi64(_mm256_slli_epi64(bits, 56), shift);
+
+		__m256i* row = (__m256i*)(rows + y + r);
+		const __m256i pixels = _mm256_loadu_si256(row);
+		collision = _mm256_or_si256(collision, _mm256_and_si256(pixels, bits));
+		_mm256_storeu_si256(row, _mm256_xor_si256(pixels, bits));
+	}
+
+	bool collided = !_mm256_testz_si256(collision, collision);
+
+	// Up to three rows left over. Not through blitSSE2: its legacy SSE encoding mixed with AVX code
+	// costs a state transition on every call, more than ten times the blit itself.
+	if (r < height)
+		collided |= blitScalar(rows, x, y + r, sprite + r, height - r);
+
+	return collided;
+}
+
+GFX_TARGET_AVX2 static bool equalAVX2(const uint64_t* a, const uint64_t* b)
+{
+	__m256i difference = _mm256_setzero_si256();
+	for (int w = 0; w < GFX_WORDS; w += 4)
+		difference = _mm256_or_si256(difference, _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + w)), _mm256_loadu_si256((const __m256i*)(b + w))));
+
+	return _mm256_testz_si256(difference, difference) != 0;
+}
+
+GFX_TARGET_AVX2 static uint64_t diffRowsAVX2(const uint64_t* a, const uint64_t* b)
+{
+	uint64_t changed = 0;
+
+	for (int w = 0; w < GFX_WORDS; w += 4)
+	{
+		const __m256i same = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(a + w)), _mm256_loadu_si256((const __m256i*)(b + w)));
+		const uint64_t mask = (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(same));
+		changed |= (~mask & 0xF) << w;
+	}
+
+	return changed;
+}
+
+GFX_TARGET_AVX2 static void scrollLeftAVX2(uint64_t* rows, int n)
+{
+	if (n <= 0)
+		return;
+
+	// Shift counts of 64 and more give 0, which is the cleared screen
+	const __m128i shift = _mm_cvtsi32_si128(n);
+	for (int w = 0; w < GFX_WORDS; w += 4)
+	{
+		__m256i* row = (__m256i*)(rows + w);
+		_mm256_storeu_si256(row, _mm256_sll_epi64(_mm256_loadu_si256(row), shift));
+	}
+}
+
+GFX_TARGET_AVX2 static void scrollRightAVX2(uint64_t* rows, int n)
+{
+	if (n <= 0)
+		return;
+
+	const __m128i shift = _mm_cvtsi32_si128(n);
+	for (int w = 0; w < GFX_WORDS; w += 4)
+	{
+		__m256i* row = (__m256i*)(rows + w);
+		_mm256_storeu_si256(row, _mm256_srl_epi64(_mm256_loadu_si256(row), shift));
+	}
+}
+
+static const chip8GfxKernels AVX2Kernels =
+{
+	"avx2",
+	clearAVX2,
+	blitAVX2,
+	equalAVX2,
+	diffRowsAVX2,
+	scrollDownScalar,
+	scrollLeftAVX2,
+	scrollRightAVX2
+};
+
+static bool cpuHasSSE2()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+	return true; // Part of x86-64
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[3] & (1 << 26)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2") != 0;
+#endif
+}
+
+static bool cpuHasAVX2()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// The OS has to save the YMM registers too (OSXSAVE and XCR0 bits 1 and 2)
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 0x6) != 0x6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif
+
+chip8Simd gfxBestSimd()
+{
+#if GFX_SIMD_KERNELS
+	if (cpuHasAVX2())
+		return chip8Simd::AVX2;
+	if (cpuHasSSE2())
+		return chip8Simd::SSE2;
+#endif
+	return chip8Simd::Scalar;
+}
+
+const chip8GfxKernels* gfxKernels(chip8Simd simd)
+{
+	switch (simd)
+	{
+		case chip8Simd::Scalar:
+			return &ScalarKernels;
+#if GFX_SIMD_KERNELS
+		case chip8Simd::SSE2:
+			return cpuHasSSE2() ? &SSE2Kernels : NULL;
+		case chip8Simd::AVX2:
+			return cpuHasAVX2() ? &AVX2Kernels : NULL;
+#endif
+		default:
+			return NULL;
+	}
+}
+
+const chip8GfxKernels& gfxActiveKernels()
+{
+	static const chip8GfxKernels* kernels = gfxKernels(gfxBestSimd());
+	return *kernels;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <cstdint>
+
+// SIMD kernels for the packed framebuffer (see framebuffer.h)
+// Every operation on whole rows of the display goes through a table of function pointers. The table
+// is picked once at runtime from the best instruction set the CPU supports: AVX2, SSE2 or plain
+// scalar code that works everywhere. The vector versions handle the 64 pixel wide screen (one word
+// per row), wider modes always use the scalar kernels.
+// All kernels take the framebuffer as GFX_HEIGHT * GFX_ROW_WORDS words, row after row.
+
+enum class chip8Simd
+{
+	Scalar,
+	SSE2,
+	AVX2
+};
+
+struct chip8GfxKernels
+{
+	const char* Name;
+
+	// Turn every pixel off
+	void (*Clear)(uint64_t* rows);
+
+	// XOR height sprite bytes onto consecutive rows starting at (x, y), both on the screen.
+	// Rows past the bottom and pixels past the right edge are clipped. Returns true when a lit pixel
+	// was turned off.
+	bool (*Blit)(uint64_t* rows, int x, int y, const uint8_t* sprite, int height);
+
+	// True when both framebuffers hold the same pixels
+	bool (*Equal)(const uint64_t* a, const uint64_t* b);
+
+	// Bit y is set when row y differs between the two framebuffers
+	uint64_t (*DiffRows)(const uint64_t* a, const uint64_t* b);
+
+	// Move the picture n rows down or n pixels sideways, the uncovered area is cleared (SCHIP 00CN, 00FB, 00FC)
+	void (*ScrollDown)(uint64_t* rows, int n);
+	void (*ScrollLeft)(uint64_t* rows, int n);
+	void (*ScrollRight)(uint64_t* rows, int n);
+};
+
+// Best instruction set this CPU and build support
+chip8Simd gfxBestSimd();
+
+// Kernels for an instruction set or NULL when the CPU or the build doesn't support it
+const chip8GfxKernels* gfxKernels(chip8Simd simd);
+
+// Kernels used by the framebuffer, picked on the first call
+const chip8GfxKernels& gfxActiveKernels();
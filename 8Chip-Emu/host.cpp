@@ -0,0 +1,197 @@
+#include "host.h"
+
+chip8Host::chip8Host(unsigned threads, uint32_t instructionsPerSecond)
+{
+	Slices = 0;
+	Steals = 0;
+	Speed = instructionsPerSecond;
+	Generation = 0;
+	Quit = false;
+	SliceCycles = HOST_DEFAULT_SLICE;
+	Remaining = 0;
+	Busy = 0;
+
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1; // hardware_concurrency may not know
+
+	for (unsigned t = 0; t < threads; t++)
+		Workers.push_back(std::unique_ptr<Worker>(new Worker()));
+
+	// Only start the threads once Workers is complete, they look at each other's queues
+	for (size_t t = 0; t < Workers.size(); t++)
+		Workers[t]->Thread = std::thread(&chip8Host::work, this, t);
+}
+
+chip8Host::~chip8Host()
+{
+	{
+		std::lock_guard<std::mutex> lock(Lock);
+		Quit = true;
+	}
+	Started.notify_all();
+
+	for (auto& worker : Workers)
+		worker->Thread.join();
+}
+
+int chip8Host::add(const uint8_t* rom, size_t size, chip8Engine engine)
+{
+	std::unique_ptr<Instance> instance(new Instance(Speed));
+	instance->Machine.setEngine(engine);
+	if (!instance->Machine.loadApplication(rom, size))
+		return -1;
+
+	instance->TargetFrames = 0;
+	Machines.push_back(std::move(instance));
+	return (int)Machines.size() - 1;
+}
+
+int chip8Host::add(const chip8RomInfo& rom, chip8Engine engine)
+{
+	std::unique_ptr<Instance> instance(new Instance(Speed));
+	instance->Machine.setEngine(engine);
+	instance->Machine.loadImage(rom.Image, rom.ImageHash);
+
+	instance->TargetFrames = 0;
+	Machines.push_back(std::move(instance));
+	return (int)Machines.size() - 1;
+}
+
+uint64_t chip8Host::runFrames(uint64_t frames, uint64_t sliceCycles)
+{
+	if (Machines.empty() || frames == 0)
+		return 0;
+
+	// Deal the machines out round robin, stealing evens out whatever this gets wrong
+	for (size_t m = 0; m < Machines.size(); m++)
+	{
+		Machines[m]->TargetFrames = Machines[m]->Scheduler.Frames + frames;
+		Workers[m % Workers.size()]->Queue.push_back(m);
+	}
+
+	for (auto& worker : Workers)
+	{
+		worker->Cycles = 0;
+		worker->Slices = 0;
+		worker->Steals = 0;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(Lock);
+		SliceCycles = sliceCycles > 0 ? sliceCycles : 1;
+		Remaining = Machines.size();
+		Busy = (unsigned)Workers.size();
+		Generation++;
+		Started.notify_all();
+
+		Finished.wait(lock, [this] { return Busy == 0; });
+	}
+
+	uint64_t cycles = 0;
+	for (auto& worker : Workers)
+	{
+		cycles += worker->Cycles;
+		Slices += worker->Slices;
+		Steals += worker->Steals;
+	}
+
+	return cycles;
+}
+
+void chip8Host::work(size_t self)
+{
+	Worker& worker = *Workers[self];
+	uint64_t seen = 0;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(Lock);
+			Started.wait(lock, [&] { return Quit || Generation != seen; });
+			if (Quit)
+				return;
+			seen = Generation;
+		}
+
+		// Keep going until every machine is done, not just the ones in this queue: a machine another
+		// worker is running right now may come back to its queue and be worth stealing
+		while (Remaining.load(std::memory_order_acquire) > 0)
+		{
+			size_t index;
+			if (!take(self, index))
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			Instance& instance = *Machines[index];
+			worker.Cycles += runSlice(instance);
+			worker.Slices++;
+
+			if (instance.Scheduler.Frames >= instance.TargetFrames)
+			{
+				Remaining.fetch_sub(1, std::memory_order_acq_rel);
+			}
+			else
+			{
+				std::lock_guard<std::mutex> lock(worker.Lock);
+				worker.Queue.push_back(index);
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(Lock);
+			if (--Busy == 0)
+				Finished.notify_one();
+		}
+	}
+}
+
+bool chip8Host::take(size_t self, size_t& index)
+{
+	// Own queue first, from the front so its machines take turns
+	{
+		Worker& worker = *Workers[self];
+		std::lock_guard<std::mutex> lock(worker.Lock);
+		if (!worker.Queue.empty())
+		{
+			index = worker.Queue.front();
+			worker.Queue.pop_front();
+			return true;
+		}
+	}
+
+	// Then the back of the others, starting with the next worker so thieves spread out
+	for (size_t n = 1; n < Workers.size(); n++)
+	{
+		Worker& victim = *Workers[(self + n) % Workers.size()];
+		std::lock_guard<std::mutex> lock(victim.Lock);
+		if (!victim.Queue.empty())
+		{
+			index = victim.Queue.back();
+			victim.Queue.pop_back();
+			Workers[self]->Steals++;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+uint64_t chip8Host::runSlice(Instance& instance)
+{
+	uint64_t executed = 0;
+
+	// A slice may cross frame boundaries, the scheduler ticks the timers at each one
+	while (executed < SliceCycles && instance.Scheduler.Frames < instance.TargetFrames)
+	{
+		executed += instance.Scheduler.runFrame(SliceCycles - executed);
+
+		// Nothing presents these frames
+		instance.Machine.DrawFlag = false;
+	}
+
+	return executed;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "chip8.h"
+#include "scheduler.h"
+#include "romindex.h"
+
+// Runs many independent chip8 machines on every core
+// The host owns the machines and a pool of worker threads. A run is cut into slices of a few
+// thousand instructions per machine: every worker keeps a queue of machines, runs a slice of the
+// one at the front and puts it back at the end until the machine has done its frames. A worker
+// whose queue runs dry steals from the back of another worker's queue, so machines that finish
+// early (or ROMs that sit in a wait loop) don't leave cores idle while others still have work.
+// Machines never share state, a machine is only ever touched by the worker running its slice.
+
+#define HOST_DEFAULT_SLICE 4096		// Instructions a machine runs before going back to the queue
+
+class chip8Host
+{
+	public:
+		// threads 0 uses every hardware thread
+		chip8Host(unsigned threads = 0, uint32_t instructionsPerSecond = SCHEDULER_DEFAULT_IPS);
+		~chip8Host();
+
+		// Add a machine running a ROM image, returns its index or -1 when the ROM doesn't fit
+		int add(const uint8_t* rom, size_t size, chip8Engine engine = chip8Engine::Interpreter);
+
+		// Add a machine running an indexed ROM, its memory shares the pages of the ROM's image
+		int add(const chip8RomInfo& rom, chip8Engine engine = chip8Engine::Interpreter);
+
+		size_t size() const { return Machines.size(); }
+		unsigned threads() const { return (unsigned)Workers.size(); }
+
+		// Only safe to use between runs
+		chip8& machine(size_t index) { return Machines[index]->Machine; }
+		chip8Scheduler& scheduler(size_t index) { return Machines[index]->Scheduler; }
+
+		// Run every machine for this many 60 Hz frames, sliceCycles instructions at a time.
+		// Blocks until all of them are done, returns the instructions executed.
+		uint64_t runFrames(uint64_t frames, uint64_t sliceCycles = HOST_DEFAULT_SLICE);
+
+		uint64_t Slices;	// Slices run by all the runs so far
+		uint64_t Steals;	// Slices a worker took from another worker's queue
+
+	private:
+		struct Instance
+		{
+			Instance(uint32_t ips) : Scheduler(Machine, ips) {}
+
+			chip8 Machine;
+			chip8Scheduler Scheduler;
+			uint64_t TargetFrames;	// Scheduler.Frames when the current run is done
+		};
+
+		struct Worker
+		{
+			std::thread Thread;
+			std::mutex Lock;			// Guards Queue, owner and thieves both take it
+			std::deque<size_t> Queue;	// Machines waiting for a slice
+			uint64_t Cycles;
+			uint64_t Slices;
+			uint64_t Steals;
+		};
+
+		std::vector<std::unique_ptr<Instance>> Machines;
+		std::vector<std::unique_ptr<Worker>> Workers;
+		uint32_t Speed;
+
+		// A run is handed to the workers by bumping Generation, they report back through Remaining
+		std::mutex Lock;
+		std::condition_variable Started;
+		std::condition_variable Finished;
+		uint64_t Generation;
+		bool Quit;
+		uint64_t SliceCycles;
+		std::atomic<size_t> Remaining;	// Machines that still have frames to run
+		unsigned Busy;					// Workers that haven't seen Remaining reach 0 yet
+
+		void work(size_t self);
+		bool take(size_t self, size_t& index);
+		uint64_t runSlice(Instance& instance);
+};
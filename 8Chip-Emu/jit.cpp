@@ -0,0 +1,351 @@
+#include "jit.h"
+#include <string.h>
+
+#if CHIP8_JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Host registers, numbered like in the x86-64 encoding
+enum
+{
+	RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// Registers the chip8 registers can be mapped to. RAX and RDX are scratch, RDI holds the chip8 instance.
+static const uint8_t AllocatableRegs[] = { RCX, RBX, RSI, RBP, R8, R9, R10, R11, R12, R13, R14, R15 };
+static const int AllocatableCount = sizeof(AllocatableRegs) / sizeof(AllocatableRegs[0]);
+
+// Callee saved registers that the native code may use
+static const uint8_t SavedRegs[] = { RBX, RBP, R12, R13, R14, R15 };
+static const int SavedCount = sizeof(SavedRegs) / sizeof(SavedRegs[0]);
+
+// Index used for I next to V0-VF in the register map
+#define JIT_REG_I 16
+
+// Minimal x86-64 encoder, byte sized operations always carry a REX prefix so SIL/DIL/BPL are reachable
+class x64Emitter
+{
+	public:
+		x64Emitter(uint8_t* code, size_t capacity) : Code(code), Capacity(capacity), Size(0) {}
+
+		bool overflow() const { return Size > Capacity; }
+		size_t size() const { return Size; }
+
+		void byte(uint8_t b) { if (Size < Capacity) Code[Size] = b; Size++; }
+		void word(uint16_t w) { byte(w & 0xFF); byte(w >> 8); }
+		void dword(uint32_t d) { word(d & 0xFFFF); word(d >> 16); }
+
+		void rex(bool w, int reg, int rm) { byte(0x40 | (w ? 8 : 0) | ((reg >> 3) << 2) | (rm >> 3)); }
+		void modrm(int mod, int reg, int rm) { byte((uint8_t)((mod << 6) | ((reg & 7) << 3) | (rm & 7))); }
+
+		// op r/m8, r8 (mov 0x88, add 0x00, or 0x08, and 0x20, sub 0x28, xor 0x30, cmp 0x38)
+		void aluReg8(uint8_t opcode, int dst, int src) { rex(false, src, dst); byte(opcode); modrm(3, src, dst); }
+		void mov8(int dst, int src) { aluReg8(0x88, dst, src); }
+		void mov8Imm(int dst, uint8_t imm) { rex(false, 0, dst); byte(0xB0 + (dst & 7)); byte(imm); }
+
+		// op r/m8, imm8 (add /0, and /4)
+		void aluImm8(int ext, int dst, uint8_t imm) { rex(false, 0, dst); byte(0x80); modrm(3, ext, dst); byte(imm); }
+
+		// Shifts of r/m8 (shl /4, shr /5)
+		void shift8(int ext, int dst) { rex(false, 0, dst); byte(0xD0); modrm(3, ext, dst); }
+		void shiftImm8(int ext, int dst, uint8_t count) { rex(false, 0, dst); byte(0xC0); modrm(3, ext, dst); byte(count); }
+
+		// setcc r/m8 (below 0x2, above or equal 0x3, above 0x7)
+		void setcc(int cc, int dst) { rex(false, 0, dst); byte(0x0F); byte(0x90 + cc); modrm(3, 0, dst); }
+
+		void movzx8(int dst, int src) { rex(false, dst, src); byte(0x0F); byte(0xB6); modrm(3, dst, src); }
+		void movzx16(int dst, int src) { rex(false, dst, src); byte(0x0F); byte(0xB7); modrm(3, dst, src); }
+
+		// 16 bit register operations for I
+		void mov16(int dst, int src) { byte(0x66); rex(false, src, dst); byte(0x89); modrm(3, src, dst); }
+		void mov16Imm(int dst, uint16_t imm) { byte(0x66); rex(false, 0, dst); byte(0xB8 + (dst & 7)); word(imm); }
+		void add16(int dst, int src) { byte(0x66); rex(false, src, dst); byte(0x01); modrm(3, src, dst); }
+
+		// Loads and stores relative to RDI
+		void load8(int dst, int32_t disp) { rex(false, dst, RDI); byte(0x8A); modrm(2, dst, RDI); dword(disp); }
+		void store8(int32_t disp, int src) { rex(false, src, RDI); byte(0x88); modrm(2, src, RDI); dword(disp); }
+		void load16(int dst, int32_t disp) { byte(0x66); rex(false, dst, RDI); byte(0x8B); modrm(2, dst, RDI); dword(disp); }
+		void store16(int32_t disp, int src) { byte(0x66); rex(false, src, RDI); byte(0x89); modrm(2, src, RDI); dword(disp); }
+		void store16Imm(int32_t disp, uint16_t imm) { byte(0x66); byte(0xC7); modrm(2, 0, RDI); dword(disp); word(imm); }
+
+		void addEaxEdx() { byte(0x01); modrm(3, RDX, RAX); }
+		void cmpEax(uint32_t imm) { byte(0x3D); dword(imm); }
+		void leaEaxTimes5() { byte(0x8D); byte(0x04); byte(0x80); } // lea eax, [rax + rax * 4]
+
+		void push(int reg) { if (reg >= 8) byte(0x41); byte(0x50 + (reg & 7)); }
+		void pop(int reg) { if (reg >= 8) byte(0x41); byte(0x58 + (reg & 7)); }
+		void ret() { byte(0xC3); }
+
+	private:
+		uint8_t* Code;
+		size_t Capacity;
+		size_t Size;
+};
+
+// Registers an instruction touches, bit 0-15 for V0-VF and bit 16 for I. Zero when it can't be compiled.
+static uint32_t jitRegisters(const chip8Instruction& in)
+{
+	const uint32_t vx = 1u << in.X;
+	const uint32_t vy = 1u << in.Y;
+	const uint32_t vf = 1u << 0xF;
+	const uint32_t i = 1u << JIT_REG_I;
+
+	switch (in.Op)
+	{
+		case OP_6XNN:
+		case OP_7XNN: return vx;
+		case OP_8XY0:
+		case OP_8XY1:
+		case OP_8XY2:
+		case OP_8XY3: return vx | vy;
+		case OP_8XY4:
+		case OP_8XY5:
+		case OP_8XY7: return vx | vy | vf;
+		case OP_8XY6:
+		case OP_8XYE: return vx | vf;
+		case OP_ANNN: return i;
+		case OP_FX1E: return vx | vf | i;
+		case OP_FX29: return vx | i;
+		default: return 0;
+	}
+}
+
+chip8Jit::chip8Jit()
+{
+	Compiled = 0;
+	Resets = 0;
+	Used = 0;
+	Full = false;
+
+	// Never writable and executable at once: the pages are made writable while a block is emitted
+	// and executable once it is done
+	void* arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	Arena = arena == MAP_FAILED ? NULL : (uint8_t*)arena;
+}
+
+chip8Jit::~chip8Jit()
+{
+	if (Arena != NULL)
+		munmap(Arena, JIT_ARENA_SIZE);
+}
+
+void chip8Jit::reset()
+{
+	if (Full)
+		Resets++;
+
+	Used = 0;
+	Full = false;
+}
+
+bool chip8Jit::compile(chip8Block& block, const chip8& c)
+{
+	if (Arena == NULL || Full)
+		return false;
+
+	// Where the registers live inside the instance, RDI points at it when the code runs
+	const uint8_t* base = (const uint8_t*)&c;
+	const int32_t offV = (int32_t)((const uint8_t*)c.V - base);
+	const int32_t offI = (int32_t)((const uint8_t*)&c.I - base);
+	const int32_t offPC = (int32_t)((const uint8_t*)&c.PC - base);
+
+	// Take the leading instructions we know how to compile while they fit in the host registers.
+	// The last instruction of the block is always left to the interpreter.
+	uint32_t used = 0;
+	uint32_t written = 0;
+	uint16_t count = 0;
+	while (count + 1 < block.Length)
+	{
+		const uint32_t regs = jitRegisters(block.Ops[count]);
+		if (regs == 0)
+			break;
+
+		uint32_t all = used | regs;
+		int needed = 0;
+		for (uint32_t bits = all; bits != 0; bits &= bits - 1)
+			needed++;
+		if (needed > AllocatableCount)
+			break;
+
+		used = all;
+		count++;
+	}
+
+	// A single instruction isn't worth a native call
+	if (count < 2)
+		return false;
+
+	int hostReg[17];
+	int next = 0;
+	for (int r = 0; r < 17; r++)
+		hostReg[r] = (used & (1u << r)) ? AllocatableRegs[next++] : -1;
+
+	// The page the block starts in may hold earlier blocks, they don't run while this one is emitted
+	static const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	const size_t first = Used & ~(pageSize - 1);
+	if (mprotect(Arena + first, JIT_ARENA_SIZE - first, PROT_READ | PROT_WRITE) != 0)
+		return false;
+
+	x64Emitter e(Arena + Used, JIT_ARENA_SIZE - Used);
+
+	for (int s = 0; s < SavedCount; s++)
+		e.push(SavedRegs[s]);
+
+	for (int r = 0; r < 16; r++)
+		if (hostReg[r] >= 0)
+			e.load8(hostReg[r], offV + r);
+	if (hostReg[JIT_REG_I] >= 0)
+		e.load16(hostReg[JIT_REG_I], offI);
+
+	// Each instruction follows its handler step by step, VF is written before VX is computed
+	// so that instructions using VF as an operand give the same result as the interpreter
+	for (uint16_t n = 0; n < count; n++)
+	{
+		const chip8Instruction& in = block.Ops[n];
+		const int vx = hostReg[in.X];
+		const int vy = hostReg[in.Y];
+		const int vf = hostReg[0xF];
+		const int ri = hostReg[JIT_REG_I];
+
+		switch (in.Op)
+		{
+			case OP_6XNN: e.mov8Imm(vx, in.NN); written |= 1u << in.X; break;
+			case OP_7XNN: e.aluImm8(0, vx, in.NN); written |= 1u << in.X; break;
+			case OP_8XY0: e.mov8(vx, vy); written |= 1u << in.X; break;
+			case OP_8XY1: e.aluReg8(0x08, vx, vy); written |= 1u << in.X; break;
+			case OP_8XY2: e.aluReg8(0x20, vx, vy); written |= 1u << in.X; break;
+			case OP_8XY3: e.aluReg8(0x30, vx, vy); written |= 1u << in.X; break;
+
+			case OP_8XY4: // VF = carry of VX + VY, then VX += VY
+				e.mov8(RAX, vx);
+				e.aluReg8(0x00, RAX, vy);
+				e.setcc(0x2, RDX);
+				e.mov8(vf, RDX);
+				e.aluReg8(0x00, vx, vy);
+				written |= (1u << in.X) | (1u << 0xF);
+				break;
+
+			case OP_8XY5: // VF = VX >= VY, then VX -= VY
+				e.mov8(RAX, vx);
+				e.aluReg8(0x38, RAX, vy);
+				e.setcc(0x3, RDX);
+				e.mov8(vf, RDX);
+				e.aluReg8(0x28, vx, vy);
+				written |= (1u << in.X) | (1u << 0xF);
+				break;
+
+			case OP_8XY6: // VF = VX & 1, then VX >>= 1
+				e.mov8(RAX, vx);
+				e.aluImm8(4, RAX, 0x01);
+				e.mov8(vf, RAX);
+				e.shift8(5, vx);
+				written |= (1u << in.X) | (1u << 0xF);
+				break;
+
+			case OP_8XY7: // VF = VY >= VX, then VX = VY - VX
+				e.mov8(RAX, vy);
+				e.aluReg8(0x38, RAX, vx);
+				e.setcc(0x3, RDX);
+				e.mov8(vf, RDX);
+				e.mov8(RAX, vy);
+				e.aluReg8(0x28, RAX, vx);
+				e.mov8(vx, RAX);
+				written |= (1u << in.X) | (1u << 0xF);
+				break;
+
+			case OP_8XYE: // VF = VX >> 7, then VX <<= 1
+				e.mov8(RAX, vx);
+				e.shiftImm8(5, RAX, 7);
+				e.mov8(vf, RAX);
+				e.shift8(4, vx);
+				written |= (1u << in.X) | (1u << 0xF);
+				break;
+
+			case OP_ANNN:
+				e.mov16Imm(ri, in.NNN);
+				written |= 1u << JIT_REG_I;
+				break;
+
+			case OP_FX1E: // VF = I + VX > 0xFFF, then I += VX
+				e.movzx8(RAX, vx);
+				e.movzx16(RDX, ri);
+				e.addEaxEdx();
+				e.cmpEax(0x0FFF);
+				e.setcc(0x7, RDX);
+				e.mov8(vf, RDX);
+				e.movzx8(RAX, vx);
+				e.add16(ri, RAX);
+				written |= (1u << 0xF) | (1u << JIT_REG_I);
+				break;
+
+			case OP_FX29: // I = VX * 5
+				e.movzx8(RAX, vx);
+				e.leaEaxTimes5();
+				e.mov16(ri, RAX);
+				written |= 1u << JIT_REG_I;
+				break;
+		}
+	}
+
+	for (int r = 0; r < 16; r++)
+		if (written & (1u << r))
+			e.store8(offV + r, hostReg[r]);
+	if (written & (1u << JIT_REG_I))
+		e.store16(offI, hostReg[JIT_REG_I]);
+	e.store16Imm(offPC, (uint16_t)(block.Start + count * 2));
+
+	for (int s = SavedCount - 1; s >= 0; s--)
+		e.pop(SavedRegs[s]);
+	e.ret();
+
+	if (e.overflow())
+	{
+		Full = true;
+		return false;
+	}
+
+	const size_t end = (Used + e.size() + pageSize - 1) & ~(pageSize - 1);
+	if (mprotect(Arena + first, end - first, PROT_READ | PROT_EXEC) != 0)
+	{
+		// Executable memory isn't allowed (SELinux execmem and the like). That shows on the first
+		// block, before any native code exists, from then on the engine stays with the block cache.
+		munmap(Arena, JIT_ARENA_SIZE);
+		Arena = NULL;
+		return false;
+	}
+
+	block.Native = (chip8NativeCode)(void*)(Arena + Used);
+	block.NativeLength = count;
+	Used += (e.size() + 15) & ~(size_t)15; // Keep every block 16 byte aligned
+	if (Used > JIT_ARENA_SIZE)
+		Used = JIT_ARENA_SIZE;
+	Compiled++;
+	return true;
+}
+
+#else
+
+chip8Jit::chip8Jit()
+{
+	Compiled = 0;
+	Resets = 0;
+	Arena = NULL;
+	Used = 0;
+	Full = false;
+}
+
+chip8Jit::~chip8Jit()
+{
+}
+
+void chip8Jit::reset()
+{
+}
+
+bool chip8Jit::compile(chip8Block& block, const chip8& c)
+{
+	return false;
+}
+
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "chip8.h"
+#include "blockcache.h"
+
+// x86-64 JIT for hot chip8 blocks
+// Blocks from the block cache count how often they run, once a block gets hot its leading
+// register-only instructions (6XNN, 7XNN, 8XYN, ANNN, FX1E, FX29) are compiled to native code.
+// The V registers and I used by the block live in host registers while it runs, PC is a constant.
+// The rest of the block, including its last instruction, still runs through the interpreter
+// handlers so jumps, draws, timers and memory writes behave exactly as before.
+// Only available on Linux x86-64, elsewhere the engine falls back to the block cache.
+
+#if defined(__x86_64__) && defined(__linux__)
+#define CHIP8_JIT_SUPPORTED 1
+#else
+#define CHIP8_JIT_SUPPORTED 0
+#endif
+
+#define JIT_HOT_THRESHOLD 64			// Block executions before it gets compiled
+#define JIT_ARENA_SIZE (256 * 1024)		// Bytes of code memory per instance, a multiple of the page size
+
+class chip8Jit
+{
+	public:
+		chip8Jit();
+		~chip8Jit();
+
+		static bool supported() { return CHIP8_JIT_SUPPORTED != 0; }
+
+		// Compile the leading instructions of a block, sets block.Native and block.NativeLength.
+		// Returns false when nothing could be compiled or the arena is full.
+		bool compile(chip8Block& block, const chip8& c);
+
+		// True once the arena ran out of space, the caller must drop every block and call reset
+		bool full() const { return Full; }
+		void reset();
+
+		uint64_t Compiled;		// Blocks compiled
+		uint64_t Resets;		// Times the arena filled up and was recycled
+
+	private:
+		uint8_t* Arena;
+		size_t Used;
+		bool Full;
+};
@@ -2,14 +2,21 @@
 // A simple 8 Chip emulator using GLFW and an interpreter
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "chip8.h"
+#include "scheduler.h"
+#include "renderer.h"
+#include "presenter.h"
+#include "emuthread.h"
+#include "movie.h"
 
 #define GLFW_DLL //Define this MACRO so that GLFW know that the functions are defined in a dll
 #include <glfw3.h>
 
 // 8 Chip screen resolution
-#define SCREEN_WIDTH 64
-#define SCREEN_HEIGHT 32
+#define SCREEN_WIDTH GFX_WIDTH
+#define SCREEN_HEIGHT GFX_HEIGHT
 
 // Let's define a zoom so that we can see the display better 
 int ZOOM = 10;
@@ -23,13 +30,14 @@ struct WindowSize {
 	int& dh = display_height;
 }WS;
 
-chip8 CPU;
+chip8Renderer Renderer;
+chip8EmuThread* Emulation = NULL; // Runs the machine, the key callback sends it the keys
 
 // Let's declare all callBackFunctions here
 void window_size_callback(GLFWwindow* window, int width, int height);
+static void window_refresh_callback(GLFWwindow* window);
 static void error_callback(int error, const char* description);
 static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
-void updateQuads(const chip8& c8);
 
 int main(int argc, char** argv)
 {
@@ -37,14 +45,59 @@ int main(int argc, char** argv)
 
 	if (argc < 2) // See if we received atleast a aplication to run
 	{
-		printf("usage: 8chip-emu.exe chip8app\n\n");
+		printf("usage: 8chip-emu.exe chip8app [-s ips] [-fps rate] [-turbo] [-skip frames] [-record movie | -replay movie]\n\n");
+		printf("  -s ips          Instructions per second (default %d)\n", SCHEDULER_DEFAULT_IPS);
+		printf("  -fps rate       Presented frames per second (default the monitor refresh rate, at most %d)\n", SCHEDULER_FRAME_RATE);
+		printf("  -turbo          Start in turbo mode, Tab switches it on and off\n");
+		printf("  -skip frames    Show one of every this many frames in turbo mode (default the newest at every present)\n");
+		printf("  -record movie   Write the keys pressed to an input movie on exit\n");
+		printf("  -replay movie   Play an input movie back, at the speed it was recorded at\n");
 		return 1;
 	}
 
+	uint32_t speed = SCHEDULER_DEFAULT_IPS;
+	double presentRate = 0.0;
+	bool turbo = false;
+	int turboSkip = 0;
+	const char* recordMovie = NULL;
+	const char* replayMovie = NULL;
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			speed = (uint32_t)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-fps") == 0 && i + 1 < argc)
+			presentRate = atof(argv[++i]);
+		else if (strcmp(argv[i], "-turbo") == 0)
+			turbo = true;
+		else if (strcmp(argv[i], "-skip") == 0 && i + 1 < argc)
+			turboSkip = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-record") == 0 && i + 1 < argc)
+			recordMovie = argv[++i];
+		else if (strcmp(argv[i], "-replay") == 0 && i + 1 < argc)
+			replayMovie = argv[++i];
+	}
+
+	// The machine belongs to main, the callbacks only talk to the emulation thread
+	chip8 CPU;
+
 	//// Call out Chip8 interpreter so that it loads the game to memory
 	if (!CPU.loadApplication(argv[1]))
 		return -1; //if this function doesn't return true there was an error
 
+	// A movie replays from the state it was recorded from, with the same number of instructions per frame
+	chip8Movie movie;
+	if (replayMovie != NULL)
+	{
+		if (!movie.read(replayMovie) || !movie.begin(CPU))
+		{
+			fprintf(stderr, "Could not replay %s\n", replayMovie);
+			return -1;
+		}
+		speed = movie.Speed;
+	}
+	else if (recordMovie != NULL)
+		movie.start(CPU, speed);
+
 	//Let's now setup OpenGL
 	GLFWwindow* window;
 
@@ -66,77 +119,136 @@ int main(int argc, char** argv)
 	//Set window resize callback
 	glfwSetWindowSizeCallback(window, window_size_callback);
 
+	// Repaint the window when it is uncovered, no frames may come in while the screen is static
+	glfwSetWindowRefreshCallback(window, window_refresh_callback);
+
 	//Set key processing for the window
 	glfwSetKeyCallback(window, key_callback);
 
 	// Make the window's context current 
 	glfwMakeContextCurrent(window);
 
+	// The presenter paces the swaps, a swap waiting for vsync would stall the emulation instead
+	glfwSwapInterval(0);
+
+	// Present at the monitor refresh rate unless told otherwise
+	if (presentRate <= 0.0)
+	{
+		const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+		presentRate = mode != NULL ? mode->refreshRate : SCHEDULER_FRAME_RATE;
+	}
+
 	//Initial window setup before the loop
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
 	glOrtho(0, WS.dw, WS.dh, 0, -1, 1); //Multiply the current matrix with an orthographic matrix so that we're able to see the vertexs | the zFar and zNear are given taking account the way the vertexs are defined
 	glMatrixMode(GL_MODELVIEW);
 
+	// The screen is drawn from a texture
+	if (!Renderer.init())
+	{
+		fprintf(stderr, "Could not create the screen texture\n");
+		glfwTerminate();
+		return -1;
+	}
+
+	// Runs the instructions of a 60 Hz frame at a time and sleeps in between
+	chip8Scheduler scheduler(CPU, speed);
+
+	// The emulation runs on its own thread and wakes this one up with an empty event after every frame
+	chip8EmuThread emulation(CPU, scheduler, glfwPostEmptyEvent);
+	Emulation = &emulation;
+	if (replayMovie != NULL || recordMovie != NULL)
+		emulation.setMovie(&movie, replayMovie == NULL);
+	emulation.setTurbo(turbo);
+	emulation.setTurboSkip(turboSkip);
+
+	// Decides which frames get shown, everything drawn in between is merged into one upload
+	chip8Presenter presenter(presentRate, glfwGetTime());
+	uint64_t lastEmulated = 0, lastPresented = 0, lastCycles = CPU.getCycleCount();
+	double lastTitle = glfwGetTime();
+	double lastLoop = lastTitle, turboTime = 0.0;
+	uint64_t turboPresents = 0;
+
+	emulation.start();
+
 	// Loop until the user closes the window 
 	while (!glfwWindowShouldClose(window))
 	{
-		// Render here 
-
-		// Do stuff here
-		CPU.emulateCycle(); //Let's advance a cycle
-		
-		if (CPU.DrawFlag == true) {
-			glClear(GL_COLOR_BUFFER_BIT);
+		// Sleep until there is an event to process, a new frame to show or a present that is due for
+		// what was drawn before. While the game waits for a key no frames come in, the timeout still
+		// brings the title up to date once a second.
+		const double wait = presenter.wait(glfwGetTime(), 1.0);
+		if (wait > 0.0)
+			glfwWaitEventsTimeout(wait);
+		else
+			glfwPollEvents();
+
+		// Only the part of the screen that was drawn on since the last present is uploaded. Without a
+		// new frame it can still be time to show what the last one drew.
+		const bool fresh = emulation.update();
+		const chip8FrameData& frame = emulation.frame();
+		const bool present = fresh ? presenter.frame(frame.Dirty, frame.Drew, glfwGetTime()) : presenter.ready(glfwGetTime());
 
+		// Render here 
+		if (present) {
 			//For now let's use the debug render
 			//CPU.debugRender(); 
 
-			updateQuads(CPU);
-			
+			// The quad covers the whole window, no need to clear first
+			Renderer.draw(frame.GFX, presenter.pending(), WS.dw, WS.dh);
+
 			// Swap front and back buffers 
 			glfwSwapBuffers(window);
+			presenter.presented();
+		}
 
-			// End of frame
-			CPU.DrawFlag = false;
+		// Turbo runs as many frames as it can, the presents still have to stay at the presenter's rate
+		const double now = glfwGetTime();
+		if (emulation.turbo())
+		{
+			turboTime += now - lastLoop;
+			turboPresents += present ? 1 : 0;
 		}
+		lastLoop = now;
 
-		// Poll for and process events 
-		glfwPollEvents();
+		// Once a second show how many frames were emulated and how many of them made it to the screen
+		if (now - lastTitle >= 1.0)
+		{
+			const chip8FrameData& frame = emulation.frame();
+			char title[128];
+			snprintf(title, sizeof(title), "8-Chip Emu - %.0f fps emulated, %.0f presented%s, %.2f M instructions/s%s",
+				(frame.Frame - lastEmulated) / (now - lastTitle), (presenter.PresentedFrames - lastPresented) / (now - lastTitle),
+				emulation.turbo() ? " (turbo)" : "", (frame.Cycles - lastCycles) / (now - lastTitle) / 1e6,
+				emulation.waiting() ? ", waiting for a key" : "");
+			glfwSetWindowTitle(window, title);
+
+			lastEmulated = frame.Frame;
+			lastPresented = presenter.PresentedFrames;
+			lastCycles = frame.Cycles;
+			lastTitle = now;
+		}
 	}
 
-	glfwTerminate();
-	return 0;
-}
+	emulation.stop();
+	Emulation = NULL;
 
-// Old gfx code
-void drawPixel(int x, int y)
-{
-	//Let's draw a single pixel(a quad) using 2 triangles
-	glBegin(GL_TRIANGLES);
-		glVertex3f(0.0f + (x * ZOOM), (y * ZOOM) + ZOOM, 1.0f); // Top Left
-		glVertex3f((x * ZOOM) + ZOOM, (y * ZOOM) + ZOOM, 1.0f); // Top Right 
-		glVertex3f((x * ZOOM) + ZOOM, (y * ZOOM) + 0.0f, 1.0f); // Bottom Right
-
-		glVertex3f((x * ZOOM) + 0.0f, (y * ZOOM) + 0.0f, 1.0f); // Bottom Left
-		glVertex3f((x * ZOOM) + ZOOM, (y * ZOOM) + 0.0f, 0.0f); // Bottom Right
-		glVertex3f((x * ZOOM) + 0.0f, (y * ZOOM) + ZOOM, 0.0f); // Top Left
-	glEnd();
-}
+	if (recordMovie != NULL && replayMovie == NULL)
+	{
+		movie.finish(CPU);
+		if (!movie.write(recordMovie))
+			fprintf(stderr, "Could not write %s\n", recordMovie);
+		else
+			printf("Movie: %zu key changes written to %s\n", movie.events(), recordMovie);
+	}
 
-void updateQuads(const chip8& c8)
-{
-	// Let's cycle through VRAM and draw every pixel
-	for (int Y = 0; Y < 32; Y++)
-		for (int X = 0; X < 64; X++)
-		{
-			if (c8.GFX[(Y * 64) + X] == 0)
-				glColor3f(0.0f, 0.0f, 0.0f);
-			else
-				glColor3f(1.0f, 1.0f, 1.0f);
+	CPU.Profiler.report(stdout); // Only in CHIP8_PROFILE builds
+	printf("Frames: %llu emulated, %llu received by the renderer, %llu presented\n", (unsigned long long)scheduler.Frames, (unsigned long long)presenter.EmulatedFrames, (unsigned long long)presenter.PresentedFrames);
+	if (turboTime > 0.0)
+		printf("Turbo: %.1f s, %.1f presents per second\n", turboTime, turboPresents / turboTime);
 
-			drawPixel(X, Y);
-		}
+	glfwTerminate();
+	return 0;
 }
 
 //OpenGL window resize
@@ -152,138 +264,85 @@ void window_size_callback(GLFWwindow* window, int width, int height)
 	// Resize quad
 	WS.display_width = width;
 	WS.display_height = height;
+
+	// Show the screen at the new size right away instead of waiting for the next present
+	window_refresh_callback(window);
+}
+
+static void window_refresh_callback(GLFWwindow* window)
+{
+	// The texture still holds the last presented frame, draw it again without uploading anything
+	Renderer.redraw(WS.dw, WS.dh);
+	glfwSwapBuffers(window);
 }
 
 
+// Keypad key for a keyboard key or -1, the keyboard's 1234/QWER/ASDF/ZXCV block is the keypad
+static int keypadKey(int key)
+{
+	switch (key)
+	{
+	case GLFW_KEY_1: return 0x1;
+	case GLFW_KEY_2: return 0x2;
+	case GLFW_KEY_3: return 0x3;
+	case GLFW_KEY_4: return 0xC;
+
+	case GLFW_KEY_Q: return 0x4;
+	case GLFW_KEY_W: return 0x5;
+	case GLFW_KEY_E: return 0x6;
+	case GLFW_KEY_R: return 0xD;
+
+	case GLFW_KEY_A: return 0x7;
+	case GLFW_KEY_S: return 0x8;
+	case GLFW_KEY_D: return 0x9;
+	case GLFW_KEY_F: return 0xE;
+
+	case GLFW_KEY_Z: return 0xA;
+	case GLFW_KEY_X: return 0x0;
+	case GLFW_KEY_C: return 0xB;
+	case GLFW_KEY_V: return 0xF;
+
+	default: return -1;
+	}
+}
+
 // OpenGL keyProcessing
-static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+static void key_callback(GLFWwindow* window, int key, int, int action, int)
 {
-	if (action == GLFW_PRESS) {
-		switch (key)
-		{
-		case GLFW_KEY_ESCAPE:
-			glfwSetWindowShouldClose(window, GLFW_TRUE);
-			break;
-
-		case GLFW_KEY_1:
-			CPU.Key[0x1] = 1;
-			break;
-		case GLFW_KEY_2:
-			CPU.Key[0x2] = 1;
-			break;
-		case GLFW_KEY_3:
-			CPU.Key[0x3] = 1;
-			break;
-		case GLFW_KEY_4:
-			CPU.Key[0xC] = 1;
-			break;
-
-		case GLFW_KEY_Q:
-			CPU.Key[0x4] = 1;
-			break;
-		case GLFW_KEY_W:
-			CPU.Key[0x5] = 1;
-			break;
-		case GLFW_KEY_E:
-			CPU.Key[0x6] = 1;
-			break;
-		case GLFW_KEY_R:
-			CPU.Key[0xD] = 1;
-			break;
-
-		case GLFW_KEY_A:
-			CPU.Key[0x7] = 1;
-			break;
-		case GLFW_KEY_S:
-			CPU.Key[0x8] = 1;
-			break;
-		case GLFW_KEY_D:
-			CPU.Key[0x9] = 1;
-			break;
-		case GLFW_KEY_F:
-			CPU.Key[0xE] = 1;
-			break;
-
-		case GLFW_KEY_Z:
-			CPU.Key[0xA] = 1;
-			break;
-		case GLFW_KEY_X:
-			CPU.Key[0x0] = 1;
-			break;
-		case GLFW_KEY_C:
-			CPU.Key[0xB] = 1;
-			break;
-		case GLFW_KEY_V:
-			CPU.Key[0xF] = 1;
-			break;
-
-		default:
-			break;
-		}
+	if (action == GLFW_PRESS && key == GLFW_KEY_ESCAPE) {
+		glfwSetWindowShouldClose(window, GLFW_TRUE);
+		return;
 	}
-	else if (action == GLFW_RELEASE) {
-		switch (key)
-		{
-		case GLFW_KEY_1:
-			CPU.Key[0x1] = 0;
-			break;
-		case GLFW_KEY_2:
-			CPU.Key[0x2] = 0;
-			break;
-		case GLFW_KEY_3:
-			CPU.Key[0x3] = 0;
-			break;
-		case GLFW_KEY_4:
-			CPU.Key[0xC] = 0;
-			break;
-
-		case GLFW_KEY_Q:
-			CPU.Key[0x4] = 0;
-			break;
-		case GLFW_KEY_W:
-			CPU.Key[0x5] = 0;
-			break;
-		case GLFW_KEY_E:
-			CPU.Key[0x6] = 0;
-			break;
-		case GLFW_KEY_R:
-			CPU.Key[0xD] = 0;
-			break;
-
-		case GLFW_KEY_A:
-			CPU.Key[0x7] = 0;
-			break;
-		case GLFW_KEY_S:
-			CPU.Key[0x8] = 0;
-			break;
-		case GLFW_KEY_D:
-			CPU.Key[0x9] = 0;
-			break;
-		case GLFW_KEY_F:
-			CPU.Key[0xE] = 0;
-			break;
-
-		case GLFW_KEY_Z:
-			CPU.Key[0xA] = 0;
-			break;
-		case GLFW_KEY_X:
-			CPU.Key[0x0] = 0;
-			break;
-		case GLFW_KEY_C:
-			CPU.Key[0xB] = 0;
-			break;
-		case GLFW_KEY_V:
-			CPU.Key[0xF] = 0;
-			break;
-
-		default:
-			break;
-		}
+
+	// Tab switches turbo mode
+	if (key == GLFW_KEY_TAB && Emulation != NULL) {
+		if (action == GLFW_PRESS)
+			Emulation->setTurbo(!Emulation->turbo());
+		return;
 	}
+
+	// Holding backspace runs the game backwards
+	if (key == GLFW_KEY_BACKSPACE && Emulation != NULL) {
+		if (action == GLFW_PRESS)
+			Emulation->setRewinding(true);
+		else if (action == GLFW_RELEASE)
+			Emulation->setRewinding(false);
+		return;
+	}
+
+	// The emulation thread reads the keys at the start of its next frame
+	const int pad = keypadKey(key);
+	if (pad < 0 || Emulation == NULL)
+		return;
+
+	if (action == GLFW_PRESS)
+		Emulation->pressKey(pad);
+	else if (action == GLFW_RELEASE)
+		Emulation->releaseKey(pad);
 }
 
 // OpenGL error callback function
-static void error_callback(int error, const char* description)
+static void error_callback(int, const char* description)
 {
 	fprintf(stderr, "Error: %s\n", description);
 }
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include "movie.h"
+#include "romfile.h"
+#include <string.h>
+#include <stdio.h>
+
+static void put16(std::vector<uint8_t>& out, uint16_t value)
+{
+	out.push_back((uint8_t)value);
+	out.push_back((uint8_t)(value >> 8));
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t value)
+{
+	for (int b = 0; b < 4; b++)
+		out.push_back((uint8_t)(value >> (8 * b)));
+}
+
+static void put64(std::vector<uint8_t>& out, uint64_t value)
+{
+	for (int b = 0; b < 8; b++)
+		out.push_back((uint8_t)(value >> (8 * b)));
+}
+
+static uint64_t get(const uint8_t* data, int bytes)
+{
+	uint64_t value = 0;
+	for (int b = 0; b < bytes; b++)
+		value |= (uint64_t)data[b] << (8 * b);
+	return value;
+}
+
+chip8Movie::chip8Movie()
+{
+	Speed = 0;
+	End = 0;
+	Keys = 0;
+	Next = 0;
+}
+
+void chip8Movie::start(const chip8& machine, uint32_t speed)
+{
+	machine.snapshot(State);
+	Events.clear();
+	Speed = speed;
+	End = machine.getCycleCount();
+	Keys = machine.getKeys(); // Part of the state already
+	Next = 0;
+}
+
+void chip8Movie::record(const chip8& machine)
+{
+	const uint16_t keys = machine.getKeys();
+	if (keys == Keys)
+		return;
+
+	const Event event = { machine.getCycleCount(), keys };
+	if (!Events.empty() && Events.back().Cycle == event.Cycle)
+		Events.back() = event; // Changed again before anything ran
+	else
+		Events.push_back(event);
+	Keys = keys;
+}
+
+void chip8Movie::finish(const chip8& machine)
+{
+	End = machine.getCycleCount();
+}
+
+bool chip8Movie::begin(chip8& machine)
+{
+	Next = 0;
+	return machine.restore(State.data(), State.size());
+}
+
+uint64_t chip8Movie::apply(chip8& machine)
+{
+	const uint64_t cycle = machine.getCycleCount();
+	while (Next < Events.size() && Events[Next].Cycle <= cycle)
+		machine.setKeys(Events[Next++].Keys);
+
+	return Next < Events.size() ? Events[Next].Cycle - cycle : UINT64_MAX;
+}
+
+void chip8Movie::write(std::vector<uint8_t>& out) const
+{
+	out.clear();
+	out.insert(out.end(), MOVIE_MAGIC, MOVIE_MAGIC + 4);
+	put16(out, MOVIE_VERSION);
+	put32(out, Speed);
+	put64(out, End);
+	put32(out, (uint32_t)State.size());
+	out.insert(out.end(), State.begin(), State.end());
+	put32(out, (uint32_t)Events.size());
+	for (const Event& event : Events)
+	{
+		put64(out, event.Cycle);
+		put16(out, event.Keys);
+	}
+}
+
+bool chip8Movie::read(const uint8_t* data, size_t size)
+{
+	// Header up to the state size
+	if (size < 22 || memcmp(data, MOVIE_MAGIC, 4) != 0)
+	{
+		fputs("Not an input movie\n", stderr);
+		return false;
+	}
+
+	const uint16_t version = (uint16_t)get(data + 4, 2);
+	if (version != MOVIE_VERSION)
+	{
+		fprintf(stderr, "Input movie version %u isn't supported\n", version);
+		return false;
+	}
+
+	const size_t stateSize = (size_t)get(data + 18, 4);
+	if (size - 22 < stateSize + 4)
+	{
+		fputs("The input movie is truncated\n", stderr);
+		return false;
+	}
+
+	const uint8_t* events = data + 22 + stateSize;
+	const size_t count = (size_t)get(events, 4);
+	events += 4;
+	if ((size_t)(data + size - events) / 10 < count)
+	{
+		fputs("The input movie is truncated\n", stderr);
+		return false;
+	}
+
+	Speed = (uint32_t)get(data + 6, 4);
+	End = get(data + 10, 8);
+	State.assign(data + 22, data + 22 + stateSize);
+	Events.resize(count);
+	for (size_t n = 0; n < count; n++, events += 10)
+	{
+		Events[n].Cycle = get(events, 8);
+		Events[n].Keys = (uint16_t)get(events + 8, 2);
+	}
+	Keys = count > 0 ? Events.back().Keys : 0;
+	Next = 0;
+
+	return true;
+}
+
+bool chip8Movie::write(const char* filename) const
+{
+	FILE* pFile = openFile(filename, "wb");
+	if (pFile == NULL)
+		return false;
+
+	std::vector<uint8_t> data;
+	write(data);
+	const bool written = fwrite(data.data(), 1, data.size(), pFile) == data.size();
+	return fclose(pFile) == 0 && written;
+}
+
+bool chip8Movie::read(const char* filename)
+{
+	FILE* pFile = openFile(filename, "rb");
+	if (pFile == NULL)
+		return false;
+
+	std::vector<uint8_t> data;
+	uint8_t buffer[4096];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+		data.insert(data.end(), buffer, buffer + n);
+	fclose(pFile);
+
+	return read(data.data(), data.size());
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "chip8.h"
+
+// Input movies
+// A movie is the state a run started from plus every change of the keys, stamped with the cycle
+// it happened at. The core is deterministic (the CXNN generator is part of the state), so applying
+// the same keys at the same cycles always gives the same run, whichever engine or runner replays
+// it and however the frames are paced. The scheduler applies the keys exactly at their cycle
+// (see chip8Scheduler::play), frames are counted the same way as long as the recording and the
+// replay both start with a new scheduler running at the recorded speed.
+//
+// File format, little endian like the save states:
+//
+//   magic        4 bytes "C8MV"
+//   version      u16  MOVIE_VERSION
+//   speed        u32  instructions per second of the recording
+//   end          u64  CycleCount when the recording stopped
+//   state size   u32, then the save state the movie starts from (see snapshot.h)
+//   event count  u32, then for every event
+//     cycle u64, keys u16   the keys from this cycle on, bit n is key n
+
+#define MOVIE_MAGIC "C8MV"
+#define MOVIE_VERSION 1
+
+class chip8Movie
+{
+	public:
+		chip8Movie();
+
+		// Recording: start from the machine's current state, then call record every time the keys
+		// may have changed (after setKeys, before running) and finish when done
+		void start(const chip8& machine, uint32_t speed);
+		void record(const chip8& machine);
+		void finish(const chip8& machine);
+
+		// Replay: put the machine in the state the movie starts from
+		bool begin(chip8& machine);
+
+		// Set the keys of every event due at the machine's cycle. Returns the cycles left until the
+		// next event, UINT64_MAX after the last one.
+		uint64_t apply(chip8& machine);
+
+		bool write(const char* filename) const;
+		bool read(const char* filename);
+		void write(std::vector<uint8_t>& out) const;
+		bool read(const uint8_t* data, size_t size);
+
+		uint32_t Speed;		// Instructions per second of the recording
+		uint64_t End;		// Cycle the recording stopped at
+
+		size_t events() const { return Events.size(); }
+
+	private:
+		struct Event
+		{
+			uint64_t Cycle;
+			uint16_t Keys;
+		};
+
+		std::vector<uint8_t> State;	// Save state the movie starts from
+		std::vector<Event> Events;
+		uint16_t Keys;				// Keys of the last event recorded
+		size_t Next;				// Next event to replay
+};
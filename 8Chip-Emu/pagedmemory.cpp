@@ -0,0 +1,143 @@
+#include "pagedmemory.h"
+#include <string.h>
+
+// Every new memory starts out with all its pages pointing at one shared page of zeros, which
+// holds a reference of its own so it is never freed
+static chip8MemoryPage* zeroPage()
+{
+	static chip8MemoryPage* page = []
+	{
+		chip8MemoryPage* p = new chip8MemoryPage;
+		p->Refs.store(1, std::memory_order_relaxed);
+		memset(p->Bytes, 0, sizeof(p->Bytes));
+		return p;
+	}();
+	return page;
+}
+
+chip8Memory::chip8Memory()
+{
+	chip8MemoryPage* zero = zeroPage();
+	zero->Refs.fetch_add(MEMORY_PAGES, std::memory_order_relaxed);
+	for (int n = 0; n < MEMORY_PAGES; n++)
+		Pages[n] = zero;
+}
+
+chip8Memory::chip8Memory(const chip8Memory& other)
+{
+	for (int n = 0; n < MEMORY_PAGES; n++)
+	{
+		Pages[n] = other.Pages[n];
+		Pages[n]->Refs.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+chip8Memory& chip8Memory::operator=(const chip8Memory& other)
+{
+	for (int n = 0; n < MEMORY_PAGES; n++)
+	{
+		if (Pages[n] == other.Pages[n])
+			continue;
+
+		other.Pages[n]->Refs.fetch_add(1, std::memory_order_relaxed);
+		release(Pages[n]);
+		Pages[n] = other.Pages[n];
+	}
+
+	return *this;
+}
+
+chip8Memory::~chip8Memory()
+{
+	for (int n = 0; n < MEMORY_PAGES; n++)
+		release(Pages[n]);
+}
+
+void chip8Memory::release(chip8MemoryPage* page)
+{
+	// The last owner frees it, acq_rel so its writes happen before the delete
+	if (page->Refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		delete page;
+}
+
+void chip8Memory::unshare(int n)
+{
+	chip8MemoryPage* copy = new chip8MemoryPage;
+	copy->Refs.store(1, std::memory_order_relaxed);
+	memcpy(copy->Bytes, Pages[n]->Bytes, sizeof(copy->Bytes));
+
+	release(Pages[n]);
+	Pages[n] = copy;
+}
+
+void chip8Memory::clear()
+{
+	chip8MemoryPage* zero = zeroPage();
+	for (int n = 0; n < MEMORY_PAGES; n++)
+	{
+		if (Pages[n] == zero)
+			continue;
+
+		zero->Refs.fetch_add(1, std::memory_order_relaxed);
+		release(Pages[n]);
+		Pages[n] = zero;
+	}
+}
+
+void chip8Memory::read(uint16_t address, uint8_t* out, size_t size) const
+{
+	// A page at a time, address + size must not pass MEMORY_SIZE
+	while (size > 0)
+	{
+		const size_t offset = address & (MEMORY_PAGE_SIZE - 1);
+		const size_t n = MEMORY_PAGE_SIZE - offset < size ? MEMORY_PAGE_SIZE - offset : size;
+		memcpy(out, Pages[address >> MEMORY_PAGE_SHIFT]->Bytes + offset, n);
+
+		address = (uint16_t)(address + n);
+		out += n;
+		size -= n;
+	}
+}
+
+void chip8Memory::write(uint16_t address, const uint8_t* data, size_t size)
+{
+	while (size > 0)
+	{
+		const size_t offset = address & (MEMORY_PAGE_SIZE - 1);
+		const size_t n = MEMORY_PAGE_SIZE - offset < size ? MEMORY_PAGE_SIZE - offset : size;
+		memcpy(writable(address >> MEMORY_PAGE_SHIFT) + offset, data, n);
+
+		address = (uint16_t)(address + n);
+		data += n;
+		size -= n;
+	}
+}
+
+void chip8Memory::assign(const uint8_t* data)
+{
+	for (int n = 0; n < MEMORY_PAGES; n++)
+	{
+		const uint8_t* bytes = data + n * MEMORY_PAGE_SIZE;
+		if (memcmp(Pages[n]->Bytes, bytes, MEMORY_PAGE_SIZE) != 0)
+			memcpy(writable(n), bytes, MEMORY_PAGE_SIZE);
+	}
+}
+
+bool chip8Memory::operator==(const chip8Memory& other) const
+{
+	for (int n = 0; n < MEMORY_PAGES; n++)
+		if (Pages[n] != other.Pages[n] && memcmp(Pages[n]->Bytes, other.Pages[n]->Bytes, MEMORY_PAGE_SIZE) != 0)
+			return false;
+
+	return true;
+}
+
+int chip8Memory::sharedPages() const
+{
+	int shared = 0;
+	for (int n = 0; n < MEMORY_PAGES; n++)
+		if (Pages[n]->Refs.load(std::memory_order_relaxed) != 1)
+			shared++;
+
+	return shared;
+}
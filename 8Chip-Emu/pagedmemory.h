@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+// Copy-on-write memory for the chip8 core
+// The 4 KB address space is split into 16 pages of 256 bytes. Pages are reference counted and
+// shared between copies, so copying a chip8Memory (forking a machine, keeping the ROM image for
+// save states) is 16 pointer copies. The first write to a shared page gives the writer its own
+// copy of just that page. Reads cost one extra pointer load compared to a flat array.
+// Reference counts are atomic, copies can be handed to other threads.
+
+#define MEMORY_SIZE 4096
+#define MEMORY_PAGE_SIZE 256
+#define MEMORY_PAGES (MEMORY_SIZE / MEMORY_PAGE_SIZE)
+#define MEMORY_PAGE_SHIFT 8
+
+struct chip8MemoryPage
+{
+	std::atomic<uint32_t> Refs;
+	uint8_t Bytes[MEMORY_PAGE_SIZE];
+};
+
+class chip8Memory
+{
+	public:
+		chip8Memory();	// All zero
+		chip8Memory(const chip8Memory& other);
+		chip8Memory& operator=(const chip8Memory& other);
+		~chip8Memory();
+
+		// address must be below MEMORY_SIZE
+		uint8_t operator[](uint16_t address) const
+		{
+			return Pages[address >> MEMORY_PAGE_SHIFT]->Bytes[address & (MEMORY_PAGE_SIZE - 1)];
+		}
+
+		void write(uint16_t address, uint8_t value)
+		{
+			writable(address >> MEMORY_PAGE_SHIFT)[address & (MEMORY_PAGE_SIZE - 1)] = value;
+		}
+
+		// Bytes of page n, only valid until the next write
+		const uint8_t* page(int n) const { return Pages[n]->Bytes; }
+
+		// Bytes of page n for writing, copied first when another chip8Memory shares it
+		uint8_t* writable(int n)
+		{
+			if (Pages[n]->Refs.load(std::memory_order_acquire) != 1)
+				unshare(n);
+			return Pages[n]->Bytes;
+		}
+
+		// True when both use the same page n, which means its bytes are equal without looking
+		bool samePage(const chip8Memory& other, int n) const { return Pages[n] == other.Pages[n]; }
+
+		void clear();
+		void read(uint16_t address, uint8_t* out, size_t size) const;
+		void write(uint16_t address, const uint8_t* data, size_t size);
+
+		// Replace everything with 4096 bytes, pages that already hold the same bytes stay shared
+		void assign(const uint8_t* data);
+
+		bool operator==(const chip8Memory& other) const;
+		bool operator!=(const chip8Memory& other) const { return !(*this == other); }
+
+		int sharedPages() const;	// Pages some other chip8Memory uses too
+
+	private:
+		chip8MemoryPage* Pages[MEMORY_PAGES];
+
+		void unshare(int n);
+		static void release(chip8MemoryPage* page);
+};
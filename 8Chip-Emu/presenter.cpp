@@ -0,0 +1,65 @@
+#include "presenter.h"
+#include "scheduler.h"
+
+chip8Presenter::chip8Presenter(double rate, double now)
+{
+	EmulatedFrames = 0;
+	DrawnFrames = 0;
+	PresentedFrames = 0;
+	Credit = 1.0; // The first change is shown right away
+	Earned = now;
+	Pending.Rows = 0;
+	setRate(rate);
+}
+
+void chip8Presenter::setRate(double rate)
+{
+	// More presents than emulated frames would only show the same picture twice
+	if (rate <= 0.0 || rate > SCHEDULER_FRAME_RATE)
+		rate = SCHEDULER_FRAME_RATE;
+
+	Rate = rate;
+}
+
+bool chip8Presenter::frame(const chip8DirtyRegion& dirty, bool drew, double now)
+{
+	EmulatedFrames++;
+	if (drew)
+		DrawnFrames++;
+
+	Pending.add(dirty);
+	return ready(now);
+}
+
+bool chip8Presenter::ready(double now)
+{
+	// Earn Rate presents per second of host time. A present spent early leaves the credit below
+	// zero so 50 presents a second really are 50, but at most one is ever owed: nothing is saved up
+	// while the screen doesn't change or the window couldn't present.
+	Credit = earned(now);
+	Earned = now;
+
+	return !Pending.empty() && Credit >= threshold();
+}
+
+double chip8Presenter::wait(double now, double longest) const
+{
+	if (Pending.empty())
+		return longest;
+
+	const double due = (threshold() - earned(now)) / Rate;
+	return due <= 0.0 ? 0.0 : (due < longest ? due : longest);
+}
+
+double chip8Presenter::earned(double now) const
+{
+	const double credit = now > Earned ? Credit + (now - Earned) * Rate : Credit;
+	return credit < 1.0 ? credit : 1.0;
+}
+
+void chip8Presenter::presented()
+{
+	PresentedFrames++;
+	Credit -= 1.0;
+	Pending.Rows = 0;
+}
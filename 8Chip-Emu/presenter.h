@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include "framebuffer.h"
+
+// Presentation pacing for the chip8 display
+// Emulated frames come at 60 Hz (see scheduler.h), or as fast as the core goes in turbo mode, but
+// the window doesn't have to show every one of them: the presenter collects what each frame drew
+// and says when it is time to present, at most Rate times per second of host time. Everything
+// drawn in between is merged into one upload and one swap.
+// Presents are earned from elapsed host time, not from the frames that come in, so a flood of
+// turbo frames can't present any faster. A present may come PRESENTER_SLACK seconds early so one
+// due every frame is never pushed back by a little timing jitter, the next one makes up for it.
+
+#define PRESENTER_SLACK 0.002	// Seconds a present may come before it is due
+
+class chip8Presenter
+{
+	public:
+		// Presents per second, anything at or above the emulated frame rate presents every changed frame.
+		// now is the host time in seconds (glfwGetTime), all the other calls take the same clock.
+		chip8Presenter(double rate, double now);
+
+		void setRate(double rate);
+		double getRate() const { return Rate; }
+
+		// Called once per emulated frame with what it drew. Returns true when the screen should be
+		// presented now, pending() then holds everything drawn since the last present.
+		bool frame(const chip8DirtyRegion& dirty, bool drew, double now);
+		const chip8DirtyRegion& pending() const { return Pending; }
+
+		// Same without a new frame: true when something drawn earlier is still waiting and its
+		// present is due by now
+		bool ready(double now);
+
+		// Seconds from now until ready() turns true, at most longest
+		double wait(double now, double longest) const;
+
+		// Call after presenting
+		void presented();
+
+		uint64_t EmulatedFrames;	// frame() calls
+		uint64_t DrawnFrames;		// Frames that drew anything
+		uint64_t PresentedFrames;	// Frames that were shown
+
+	private:
+		double Rate;
+		double Credit;				// Presents earned, one is spent per present
+		double Earned;				// Host time the credit was last brought up to
+		chip8DirtyRegion Pending;
+
+		double earned(double now) const;	// Credit brought up to now
+		double threshold() const { return 1.0 - PRESENTER_SLACK * Rate - 1e-9; }	// Credit a present needs
+};
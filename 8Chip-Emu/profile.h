@@ -0,0 +1,269 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include "romfile.h"
+
+// Instruction profiler for the chip8 core
+// Selected at compile time like the tracer (see trace.h): with CHIP8_PROFILE set to 0 every call is
+// an empty inline function, with CHIP8_PROFILE set to 1 every executed instruction is counted by
+// address and by instruction, and about one in PROFILE_SAMPLE_INTERVAL handlers is timed with the
+// time stamp counter. The gaps between timed handlers are random, a fixed one would keep timing
+// the same instruction of a loop whose length divides it.
+// The calls are followed through 2NNN and 00EE so the counts can also be written as folded stacks
+// ("0x200;0x2a4;0x31e 1234" per line) for flamegraph.pl and compatible viewers.
+// Profiled builds always use the interpreter, the other engines don't run instructions one by one.
+
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE 0
+#endif
+
+#if CHIP8_PROFILE
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define CHIP8_PROFILE_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CHIP8_PROFILE_RDTSC 1
+#endif
+#endif
+
+#define PROFILE_SAMPLE_INTERVAL 64	// Average instructions between two timed handlers, a power of two
+#define PROFILE_MAX_DEPTH 16		// Same as the chip8 stack, deeper calls count in the deepest frame
+#define PROFILE_OPS 35				// Instructions in chip8Op, these three are checked in chip8.cpp
+#define PROFILE_OP_CALL 4			// OP_2NNN
+#define PROFILE_OP_RETURN 2			// OP_00EE
+
+template <bool Enabled>
+class chip8Profile;
+
+// Profiling compiled out, everything folds away
+template <>
+class chip8Profile<false>
+{
+	public:
+		static const bool Enabled = false;
+
+		void reset(uint16_t) {}
+		void count(uint16_t, uint16_t, uint8_t, uint16_t) {}
+		uint64_t start() { return 0; }
+		void stop(uint8_t, uint64_t) {}
+		uint64_t total() const { return 0; }
+		void report(FILE*, size_t = 0) const {}
+		bool dumpFolded(const char*) const { return false; }
+};
+
+// Profiling compiled in
+template <>
+class chip8Profile<true>
+{
+	public:
+		static const bool Enabled = true;
+
+		chip8Profile() { reset(0x200); }
+
+		// Forget everything, calls are followed from entry
+		void reset(uint16_t entry)
+		{
+			memset(PCCounts, 0, sizeof(PCCounts));
+			memset(PCOpcodes, 0, sizeof(PCOpcodes));
+			memset(OpCounts, 0, sizeof(OpCounts));
+			memset(OpTicks, 0, sizeof(OpTicks));
+			memset(OpSamples, 0, sizeof(OpSamples));
+			Total = 0;
+			NextSample = 0;
+			SampleState = 0x9E3779B97F4A7C15ULL;
+
+			Frames.clear();
+			Children.clear();
+			Frame root = { 0, entry, 0, 0 };
+			Frames.push_back(root);
+			Current = 0;
+			Overflow = 0;
+		}
+
+		// An instruction is about to run. The calling frame gets 2NNN, the called one gets 00EE.
+		void count(uint16_t pc, uint16_t opcode, uint8_t op, uint16_t nnn)
+		{
+			PCCounts[pc & 0x0FFF]++;
+			PCOpcodes[pc & 0x0FFF] = opcode;
+			OpCounts[op]++;
+			Frames[Current].Count++;
+			Total++;
+
+			if (op == PROFILE_OP_CALL)
+				enter(nnn);
+			else if (op == PROFILE_OP_RETURN && Overflow > 0)
+				Overflow--;
+			else if (op == PROFILE_OP_RETURN && Current != 0)
+				Current = Frames[Current].Parent;
+		}
+
+		// Time stamp before a handler when this one is sampled, 0 otherwise
+		uint64_t start()
+		{
+			if (Total < NextSample)
+				return 0;
+
+			// xorshift64, the gap is 1 to 2 * PROFILE_SAMPLE_INTERVAL - 1 instructions
+			SampleState ^= SampleState << 13;
+			SampleState ^= SampleState >> 7;
+			SampleState ^= SampleState << 17;
+			NextSample = Total + 1 + SampleState % (2 * PROFILE_SAMPLE_INTERVAL - 1);
+			return ticks();
+		}
+
+		void stop(uint8_t op, uint64_t started)
+		{
+			if (started == 0)
+				return;
+
+			OpTicks[op] += ticks() - started;
+			OpSamples[op]++;
+		}
+
+		uint64_t total() const { return Total; }
+
+		// Instructions sorted by how often they ran with the average sampled handler time, then
+		// the top addresses
+		void report(FILE* out, size_t top = 20) const
+		{
+			fprintf(out, "Profile: %llu instructions, handler time in %s\n", (unsigned long long)Total, tickUnit());
+			if (Total == 0)
+				return;
+
+			uint8_t ops[PROFILE_OPS];
+			for (int n = 0; n < PROFILE_OPS; n++)
+				ops[n] = (uint8_t)n;
+			std::sort(ops, ops + PROFILE_OPS, [this](uint8_t a, uint8_t b) { return OpCounts[a] > OpCounts[b]; });
+
+			// The time of an instruction is estimated from its samples, it's only a share of the total
+			double estimated = 0.0;
+			for (int n = 0; n < PROFILE_OPS; n++)
+				if (OpSamples[n] > 0)
+					estimated += (double)OpTicks[n] / OpSamples[n] * OpCounts[n];
+
+			fprintf(out, "%-6s %14s %7s %10s %7s\n", "op", "count", "count%", "avg time", "time%");
+			for (int n = 0; n < PROFILE_OPS && OpCounts[ops[n]] > 0; n++)
+			{
+				const uint8_t op = ops[n];
+				const double average = OpSamples[op] > 0 ? (double)OpTicks[op] / OpSamples[op] : 0.0;
+				fprintf(out, "%-6s %14llu %6.2f%% %10.1f %6.2f%%\n", opName(op), (unsigned long long)OpCounts[op],
+					100.0 * OpCounts[op] / Total, average, estimated > 0.0 ? 100.0 * average * OpCounts[op] / estimated : 0.0);
+			}
+
+			std::vector<uint16_t> pcs;
+			for (uint16_t pc = 0; pc < 4096; pc++)
+				if (PCCounts[pc] > 0)
+					pcs.push_back(pc);
+			std::sort(pcs.begin(), pcs.end(), [this](uint16_t a, uint16_t b) { return PCCounts[a] > PCCounts[b]; });
+			if (top > 0 && pcs.size() > top)
+				pcs.resize(top);
+
+			fprintf(out, "%-6s %-6s %14s %7s\n", "PC", "opcode", "count", "count%");
+			for (size_t n = 0; n < pcs.size(); n++)
+				fprintf(out, "%#05x  %04x   %14llu %6.2f%%\n", pcs[n], PCOpcodes[pcs[n]], (unsigned long long)PCCounts[pcs[n]], 100.0 * PCCounts[pcs[n]] / Total);
+		}
+
+		// One line per call path with the instructions that ran in its innermost subroutine
+		bool dumpFolded(const char* filename) const
+		{
+			FILE* pFile = openFile(filename, "w");
+			if (pFile == NULL)
+				return false;
+
+			bool ok = true;
+			uint16_t path[PROFILE_MAX_DEPTH + 1];
+			for (size_t f = 0; ok && f < Frames.size(); f++)
+			{
+				if (Frames[f].Count == 0)
+					continue;
+
+				int depth = 0;
+				for (size_t p = f; ; p = Frames[p].Parent)
+				{
+					path[depth++] = Frames[p].Address;
+					if (p == 0)
+						break;
+				}
+
+				while (depth > 1)
+					ok = ok && fprintf(pFile, "%#05x;", path[--depth]) > 0;
+				ok = ok && fprintf(pFile, "%#05x %llu\n", path[0], (unsigned long long)Frames[f].Count) > 0;
+			}
+
+			return fclose(pFile) == 0 && ok;
+		}
+
+	private:
+		// A subroutine reached through a given path of calls
+		struct Frame
+		{
+			size_t Parent;
+			uint16_t Address;
+			uint8_t Depth;
+			uint64_t Count;		// Instructions that ran in it, not in what it called
+		};
+
+		uint64_t PCCounts[4096];
+		uint16_t PCOpcodes[4096];		// Last opcode seen at every address
+		uint64_t OpCounts[PROFILE_OPS];
+		uint64_t OpTicks[PROFILE_OPS];
+		uint64_t OpSamples[PROFILE_OPS];
+		uint64_t Total;
+		uint64_t NextSample;	// Total when the next handler is timed
+		uint64_t SampleState;
+
+		std::vector<Frame> Frames;		// Frames[0] is the program entry
+		std::map<std::pair<size_t, uint16_t>, size_t> Children;	// (frame, called address) to frame
+		size_t Current;
+		int Overflow;		// Calls past PROFILE_MAX_DEPTH that haven't returned yet
+
+		static const char* opName(uint8_t op)
+		{
+			// In chip8Op order
+			static const char* const names[PROFILE_OPS] = {
+				"????", "00E0", "00EE", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN",
+				"8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE", "9XY0",
+				"ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1", "FX07", "FX0A", "FX15", "FX18",
+				"FX1E", "FX29", "FX33", "FX55", "FX65"
+			};
+			return names[op];
+		}
+
+#ifdef CHIP8_PROFILE_RDTSC
+		static const char* tickUnit() { return "TSC ticks"; }
+		static uint64_t ticks() { return __rdtsc(); }
+#else
+		static const char* tickUnit() { return "ns"; }
+		static uint64_t ticks() { return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+#endif
+
+		void enter(uint16_t address)
+		{
+			if (Frames[Current].Depth >= PROFILE_MAX_DEPTH)
+			{
+				Overflow++;
+				return;
+			}
+
+			const std::pair<size_t, uint16_t> key(Current, address & 0x0FFF);
+			std::map<std::pair<size_t, uint16_t>, size_t>::const_iterator it = Children.find(key);
+			if (it != Children.end())
+			{
+				Current = it->second;
+				return;
+			}
+
+			Frame frame = { Current, (uint16_t)(address & 0x0FFF), (uint8_t)(Frames[Current].Depth + 1), 0 };
+			Frames.push_back(frame);
+			Children[key] = Frames.size() - 1;
+			Current = Frames.size() - 1;
+		}
+};
+
+typedef chip8Profile<CHIP8_PROFILE != 0> Profile;
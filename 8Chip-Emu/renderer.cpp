@@ -0,0 +1,98 @@
+#include "renderer.h"
+#include <string.h>
+
+#define GLFW_DLL
+#include <glfw3.h> // Brings in the platform OpenGL header
+
+chip8Renderer::chip8Renderer()
+{
+	Texture = 0;
+	UploadedPixels = 0;
+}
+
+bool chip8Renderer::init()
+{
+	glGenTextures(1, &Texture);
+	if (Texture == 0)
+		return false;
+
+	glBindTexture(GL_TEXTURE_2D, Texture);
+
+	// Nearest filtering keeps the pixels square instead of blurring them when scaled up
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+
+	// Rows of GFX_WIDTH bytes are tightly packed, sub-rectangles are read out of the full staging buffer
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, GFX_WIDTH);
+
+	// 64x32 is a power of two, fine even for plain OpenGL 1.1
+	memset(Pixels, 0, sizeof(Pixels));
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, GFX_WIDTH, GFX_HEIGHT, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, Pixels);
+
+	return glGetError() == GL_NO_ERROR;
+}
+
+void chip8Renderer::upload(const chip8Framebuffer& gfx, int top, int bottom, int left, int right)
+{
+	// One bit per pixel to one byte per pixel, the leftmost pixel is the top bit of the row
+	for (int y = top; y <= bottom; y++)
+	{
+		const uint64_t* row = gfx.row(y);
+		uint8_t* out = Pixels + y * GFX_WIDTH;
+
+		for (int x = left; x <= right; x++)
+			out[x] = (uint8_t)(0 - (uint8_t)(row[x / 64] >> (63 - x % 64) & 1)); // 0 or 255
+	}
+
+	// GL_UNPACK_ROW_LENGTH lets GL pick the rectangle straight out of the staging buffer
+	const int width = right - left + 1;
+	const int height = bottom - top + 1;
+	glTexSubImage2D(GL_TEXTURE_2D, 0, left, top, width, height, GL_LUMINANCE, GL_UNSIGNED_BYTE, Pixels + top * GFX_WIDTH + left);
+	UploadedPixels += (uint64_t)width * height;
+}
+
+void chip8Renderer::draw(const chip8Framebuffer& gfx, const chip8DirtyRegion& dirty, int width, int height)
+{
+	glBindTexture(GL_TEXTURE_2D, Texture);
+
+	// One rectangle from the first to the last dirty row, between them only the dirty columns
+	if (!dirty.empty())
+	{
+		int top = 0;
+		while ((dirty.Rows >> top & 1) == 0)
+			top++;
+
+		int bottom = GFX_HEIGHT - 1;
+		while ((dirty.Rows >> bottom & 1) == 0)
+			bottom--;
+
+		upload(gfx, top, bottom, dirty.Left, dirty.Right);
+	}
+
+	redraw(width, height);
+}
+
+void chip8Renderer::redraw(int width, int height)
+{
+	if (Texture == 0)
+		return;
+
+	glBindTexture(GL_TEXTURE_2D, Texture);
+
+	// The texture holds the final colors, draw it as is
+	glEnable(GL_TEXTURE_2D);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+
+	// Texture row 0 is the top of the screen, the projection has y going down
+	glBegin(GL_QUADS);
+		glTexCoord2f(0.0f, 0.0f); glVertex2f(0.0f, 0.0f);						// Top Left
+		glTexCoord2f(1.0f, 0.0f); glVertex2f((float)width, 0.0f);				// Top Right
+		glTexCoord2f(1.0f, 1.0f); glVertex2f((float)width, (float)height);		// Bottom Right
+		glTexCoord2f(0.0f, 1.0f); glVertex2f(0.0f, (float)height);				// Bottom Left
+	glEnd();
+
+	glDisable(GL_TEXTURE_2D);
+}
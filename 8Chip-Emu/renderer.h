@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include "framebuffer.h"
+
+// OpenGL renderer for the chip8 display
+// The framebuffer is expanded to one luminance byte per pixel, uploaded into a small texture with
+// a single glTexSubImage2D and drawn as one textured quad with nearest filtering, so every pixel
+// stays a sharp square at any window size. Only the dirty region since the last frame is expanded
+// and uploaded, the texture keeps the rest. Only needs OpenGL 1.1 and a current context.
+// The texture belongs to the context and goes away with it.
+
+class chip8Renderer
+{
+	public:
+		chip8Renderer();
+
+		// Create the texture, call once the GL context is current
+		bool init();
+
+		// Upload the dirty part of gfx and draw the whole screen over the rectangle (0, 0) - (width, height)
+		// of the current projection
+		void draw(const chip8Framebuffer& gfx, const chip8DirtyRegion& dirty, int width, int height);
+
+		// Draw what the texture already holds without uploading anything, for when the window has to
+		// be repainted (resized, uncovered) but no new frame is shown. Does nothing before init.
+		void redraw(int width, int height);
+
+		uint64_t UploadedPixels;	// Texels sent to GL since init, for measuring
+
+	private:
+		unsigned int Texture;						// GLuint
+		uint8_t Pixels[GFX_HEIGHT * GFX_WIDTH];		// Staging buffer, 0 or 255 per pixel
+
+		void upload(const chip8Framebuffer& gfx, int top, int bottom, int left, int right);
+};
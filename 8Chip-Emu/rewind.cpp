@@ -0,0 +1,219 @@
+#include "rewind.h"
+#include <string.h>
+
+// A record is a list of (unchanged bytes, changed bytes, XOR of the changed bytes) groups with
+// both counts as LEB128 varints, a state that didn't change at all encodes to nothing
+
+static void putVarint(std::vector<uint8_t>& out, size_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back((uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((uint8_t)value);
+}
+
+static size_t getVarint(const uint8_t*& p)
+{
+	size_t value = 0;
+	int shift = 0;
+	while (*p & 0x80)
+	{
+		value |= (size_t)(*p++ & 0x7F) << shift;
+		shift += 7;
+	}
+	value |= (size_t)*p++ << shift;
+	return value;
+}
+
+// XOR state with base (zeros when base is NULL) and run length encode the result
+static void encodeDelta(const std::vector<uint8_t>& state, const uint8_t* base, std::vector<uint8_t>& out)
+{
+	out.clear();
+
+	const size_t size = state.size();
+	const uint8_t* s = state.data();
+	size_t n = 0;
+	while (n < size)
+	{
+		// Unchanged bytes, a word at a time where possible
+		const size_t same = n;
+		for (;;)
+		{
+			if (base != NULL && n + 8 <= size && memcmp(s + n, base + n, 8) == 0)
+				n += 8;
+			else if (n < size && s[n] == (base != NULL ? base[n] : 0))
+				n++;
+			else
+				break;
+		}
+		if (n == size)
+			break;
+
+		// Changed bytes, a single unchanged byte doesn't end them (a new group costs at least two)
+		const size_t changed = n;
+		while (n < size && (s[n] != (base != NULL ? base[n] : 0) || (n + 1 < size && s[n + 1] != (base != NULL ? base[n + 1] : 0))))
+			n++;
+
+		putVarint(out, changed - same);
+		putVarint(out, n - changed);
+		for (size_t b = changed; b < n; b++)
+			out.push_back(s[b] ^ (base != NULL ? base[b] : 0));
+	}
+}
+
+static void applyDelta(std::vector<uint8_t>& state, const uint8_t* record, size_t size)
+{
+	const uint8_t* p = record;
+	const uint8_t* end = record + size;
+	size_t n = 0;
+	while (p < end)
+	{
+		n += getVarint(p);
+		const size_t changed = getVarint(p);
+		for (size_t b = 0; b < changed; b++)
+			state[n + b] ^= p[b];
+		p += changed;
+		n += changed;
+	}
+}
+
+chip8Rewind::chip8Rewind(size_t bytes, int keyframeInterval) : Ring(bytes)
+{
+	KeyframeInterval = keyframeInterval > 0 ? keyframeInterval : 1;
+	clear();
+}
+
+void chip8Rewind::clear()
+{
+	Records.clear();
+	Head = 0;
+	Used = 0;
+	SinceKeyframe = 0;
+	Previous.clear();
+}
+
+void chip8Rewind::dropOldest()
+{
+	// A keyframe goes together with the frames that were encoded against it
+	do
+	{
+		Used -= Records.front().Size;
+		Records.pop_front();
+	} while (!Records.empty() && !Records.front().Keyframe);
+}
+
+bool chip8Rewind::store(const std::vector<uint8_t>& encoded, bool keyframe)
+{
+	const size_t size = encoded.size();
+	if (size > Ring.size())
+	{
+		clear();
+		return false;
+	}
+
+	// Find room after the newest record, the oldest ones make way
+	size_t at;
+	for (;;)
+	{
+		if (Records.empty())
+		{
+			Head = 0;
+			at = 0;
+			break;
+		}
+
+		const size_t tail = Records.front().Offset;
+		if (Head > tail)
+		{
+			// Free space at the end of the ring and in front of the oldest record
+			if (size <= Ring.size() - Head)
+			{
+				at = Head;
+				break;
+			}
+			if (size <= tail)
+			{
+				at = 0;
+				break;
+			}
+		}
+		else if (size <= tail - Head)
+		{
+			at = Head;
+			break;
+		}
+
+		dropOldest();
+
+		// A frame needs its keyframe
+		if (Records.empty() && !keyframe)
+			return false;
+	}
+
+	if (size > 0)
+		memcpy(Ring.data() + at, encoded.data(), size);
+
+	Record record = { at, size, keyframe };
+	Records.push_back(record);
+	Head = at + size;
+	Used += size;
+	return true;
+}
+
+void chip8Rewind::push(const chip8& machine)
+{
+	machine.snapshot(Current, false);
+
+	bool keyframe = Records.empty() || SinceKeyframe + 1 >= KeyframeInterval || Previous.size() != Current.size();
+	encodeDelta(Current, keyframe ? NULL : Previous.data(), Encoded);
+
+	if (!store(Encoded, keyframe) && !keyframe)
+	{
+		// The keyframe this frame was encoded against had to go, store it on its own
+		keyframe = true;
+		encodeDelta(Current, NULL, Encoded);
+		if (!store(Encoded, true))
+			return;
+	}
+
+	SinceKeyframe = keyframe ? 0 : SinceKeyframe + 1;
+	Previous.swap(Current);
+}
+
+int chip8Rewind::rewind(chip8& machine, int frames)
+{
+	if (Records.empty())
+		return 0;
+
+	if (frames < 0)
+		frames = 0;
+	if (frames > (int)Records.size() - 1)
+		frames = (int)Records.size() - 1;
+
+	const size_t target = Records.size() - 1 - frames;
+	size_t keyframe = target;
+	while (!Records[keyframe].Keyframe)
+		keyframe--;
+
+	// Decode forward from the keyframe
+	Current.assign(Previous.size(), 0);
+	for (size_t r = keyframe; r <= target; r++)
+		applyDelta(Current, Ring.data() + Records[r].Offset, Records[r].Size);
+
+	if (!machine.restore(Current.data(), Current.size()))
+		return 0;
+
+	// The frames after the target are gone, the next push continues from it
+	while (Records.size() > target + 1)
+	{
+		Used -= Records.back().Size;
+		Records.pop_back();
+	}
+	Head = Records.back().Offset + Records.back().Size;
+	SinceKeyframe = (int)(target - keyframe);
+	Previous.swap(Current);
+
+	return frames;
+}
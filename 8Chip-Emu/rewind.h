@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include "chip8.h"
+
+// Rewind history for a chip8 machine
+// push() is called once per frame and keeps the machine state in a ring buffer of fixed size. Each
+// state is the full save state (see snapshot.h) XORed with the one before it and run length encoded,
+// a frame usually only changes a few registers, some pixels and a handful of bytes of memory, so
+// it takes tens of bytes instead of 4 KB. Every REWIND_KEYFRAME_INTERVAL frames the state is stored
+// against zeros instead (a keyframe) so going back only has to decode the frames since the last
+// keyframe. When the ring is full the oldest keyframe is dropped together with its frames.
+
+#define REWIND_DEFAULT_BYTES (1 << 20)		// 1 MB, several minutes for most ROMs
+#define REWIND_KEYFRAME_INTERVAL 60			// A keyframe a second at 60 frames per second
+
+class chip8Rewind
+{
+	public:
+		chip8Rewind(size_t bytes = REWIND_DEFAULT_BYTES, int keyframeInterval = REWIND_KEYFRAME_INTERVAL);
+
+		// Remember the current state of the machine as the newest frame
+		void push(const chip8& machine);
+
+		// Put the machine back to the state from frames pushes ago (0 is the newest) and forget the
+		// newer ones. Goes back as far as the history reaches, returns how many frames that was.
+		int rewind(chip8& machine, int frames);
+
+		void clear();
+
+		int frames() const { return (int)Records.size(); }	// States that can be gone back to
+		size_t bytes() const { return Used; }				// Ring space they take
+
+	private:
+		struct Record
+		{
+			size_t Offset;		// Where the encoded state starts in Ring
+			size_t Size;
+			bool Keyframe;
+		};
+
+		std::vector<uint8_t> Ring;
+		std::deque<Record> Records;	// Oldest first, the first one is always a keyframe
+		size_t Head;				// Where the next record goes
+		size_t Used;
+		int KeyframeInterval;
+		int SinceKeyframe;			// Frames pushed since the newest keyframe
+
+		std::vector<uint8_t> Previous;	// Full save state of the newest frame
+		std::vector<uint8_t> Current;
+		std::vector<uint8_t> Encoded;
+
+		bool store(const std::vector<uint8_t>& encoded, bool keyframe);	// False when it had to drop every record and keyframe is false
+		void dropOldest();
+};
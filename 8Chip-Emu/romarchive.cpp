@@ -0,0 +1,167 @@
+#include "romarchive.h"
+#include "scheduler.h"
+#include <string.h>
+#include <stdio.h>
+
+static uint64_t get(const uint8_t* data, int bytes)
+{
+	uint64_t value = 0;
+	for (int b = 0; b < bytes; b++)
+		value |= (uint64_t)data[b] << (8 * b);
+	return value;
+}
+
+static void put(uint8_t* data, uint64_t value, int bytes)
+{
+	for (int b = 0; b < bytes; b++)
+		data[b] = (uint8_t)(value >> (8 * b));
+}
+
+bool chip8RomArchive::open(const char* filename)
+{
+	close();
+	if (!File.open(filename))
+	{
+		fprintf(stderr, "Could not open %s\n", filename);
+		return false;
+	}
+
+	const uint8_t* data = File.data();
+	const size_t size = File.size();
+	if (size < ARCHIVE_HEADER_SIZE || memcmp(data, ARCHIVE_MAGIC, 4) != 0)
+	{
+		fprintf(stderr, "%s is not a ROM archive\n", filename);
+		close();
+		return false;
+	}
+
+	const uint16_t version = (uint16_t)get(data + 4, 2);
+	const size_t entrySize = (size_t)get(data + 6, 2);
+	const size_t count = (size_t)get(data + 8, 4);
+	if (version != ARCHIVE_VERSION || entrySize < ARCHIVE_ENTRY_SIZE || (size - ARCHIVE_HEADER_SIZE) / entrySize < count)
+	{
+		fprintf(stderr, "%s: archive version %u isn't supported or the table is truncated\n", filename, version);
+		close();
+		return false;
+	}
+
+	Entries.resize(count);
+	for (size_t n = 0; n < count; n++)
+	{
+		const uint8_t* in = data + ARCHIVE_HEADER_SIZE + n * entrySize;
+		chip8ArchiveEntry& entry = Entries[n];
+
+		const size_t offset = (size_t)get(in, 4);
+		const size_t length = (size_t)get(in + 4, 4);
+		const size_t nameOffset = (size_t)get(in + 8, 4);
+		const size_t nameLength = (size_t)get(in + 12, 2);
+		const uint8_t variant = in[16];
+		if (offset > size || size - offset < length || nameOffset > size || size - nameOffset < nameLength || variant > (uint8_t)chip8Variant::XoChip)
+		{
+			fprintf(stderr, "%s: entry %zu is corrupt\n", filename, n);
+			close();
+			return false;
+		}
+
+		entry.Name.assign((const char*)data + nameOffset, nameLength);
+		entry.Data = data + offset;
+		entry.Size = length;
+		entry.Quirks = (uint16_t)get(in + 14, 2);
+		entry.Variant = (chip8Variant)variant;
+		entry.HasHash = (in[17] & ARCHIVE_HAS_HASH) != 0;
+		entry.Cycles = get(in + 24, 8);
+		entry.Seed = get(in + 32, 8);
+		entry.Hash = get(in + 40, 8);
+	}
+
+	return true;
+}
+
+void chip8RomArchive::close()
+{
+	Entries.clear();
+	File.close();
+}
+
+const chip8ArchiveEntry* chip8RomArchive::find(const char* name) const
+{
+	for (const chip8ArchiveEntry& entry : Entries)
+		if (entry.Name == name)
+			return &entry;
+
+	return NULL;
+}
+
+uint64_t chip8RomArchive::play(const chip8ArchiveEntry& entry, chip8Engine engine)
+{
+	chip8 machine;
+	machine.setEngine(engine);
+	machine.seedRandom(entry.Seed);
+	if (!machine.loadApplication(entry.Data, entry.Size))
+		return 0;
+
+	chip8Scheduler scheduler(machine, SCHEDULER_DEFAULT_IPS);
+	uint64_t cycles = 0;
+	while (cycles < entry.Cycles)
+		cycles += scheduler.runFrame(entry.Cycles - cycles);
+
+	return machine.getFramebuffer().hash();
+}
+
+bool chip8RomArchive::write(std::vector<uint8_t>& out, const std::vector<chip8ArchiveEntry>& entries)
+{
+	out.clear();
+
+	// Table, then the names, then the ROMs. Offsets and sizes are 32 bits, name lengths 16.
+	uint64_t end = ARCHIVE_HEADER_SIZE + (uint64_t)entries.size() * ARCHIVE_ENTRY_SIZE;
+	for (const chip8ArchiveEntry& entry : entries)
+	{
+		if (entry.Name.size() > UINT16_MAX)
+		{
+			fprintf(stderr, "%.64s...: the name is longer than %u characters\n", entry.Name.c_str(), (unsigned)UINT16_MAX);
+			return false;
+		}
+		end += entry.Name.size() + (uint64_t)entry.Size;
+	}
+	if (end > UINT32_MAX)
+	{
+		fprintf(stderr, "The archive would be %llu bytes, at most %u fit\n", (unsigned long long)end, (unsigned)UINT32_MAX);
+		return false;
+	}
+
+	size_t names = ARCHIVE_HEADER_SIZE + entries.size() * ARCHIVE_ENTRY_SIZE;
+	size_t roms = names;
+	for (const chip8ArchiveEntry& entry : entries)
+		roms += entry.Name.size();
+
+	out.assign(ARCHIVE_HEADER_SIZE + entries.size() * ARCHIVE_ENTRY_SIZE, 0);
+	memcpy(out.data(), ARCHIVE_MAGIC, 4);
+	put(out.data() + 4, ARCHIVE_VERSION, 2);
+	put(out.data() + 6, ARCHIVE_ENTRY_SIZE, 2);
+	put(out.data() + 8, entries.size(), 4);
+
+	for (size_t n = 0; n < entries.size(); n++)
+	{
+		const chip8ArchiveEntry& entry = entries[n];
+		uint8_t* table = out.data() + ARCHIVE_HEADER_SIZE + n * ARCHIVE_ENTRY_SIZE;
+		put(table, roms, 4);
+		put(table + 4, entry.Size, 4);
+		put(table + 8, names, 4);
+		put(table + 12, entry.Name.size(), 2);
+		put(table + 14, entry.Quirks, 2);
+		table[16] = (uint8_t)entry.Variant;
+		table[17] = entry.HasHash ? ARCHIVE_HAS_HASH : 0;
+		put(table + 24, entry.Cycles, 8);
+		put(table + 32, entry.Seed, 8);
+		put(table + 40, entry.Hash, 8);
+
+		names += entry.Name.size();
+		roms += entry.Size;
+	}
+
+	for (const chip8ArchiveEntry& entry : entries)
+		out.insert(out.end(), entry.Name.begin(), entry.Name.end());
+	for (const chip8ArchiveEntry& entry : entries)
+		out.insert(out.end(), entry.Data, entry.Data + entry.Size);
+	return true;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "romfile.h"
+#include "romindex.h"
+
+// ROM archive, many ROMs with what a regression run needs to know about them in a single file
+// The archive is mapped once and every entry's Data points straight into the mapping, so starting
+// a machine on an archived ROM is the same copy into memory as loading a single ROM file.
+// Everything is little endian:
+//
+//   header, ARCHIVE_HEADER_SIZE bytes
+//     magic        4 bytes "C8PK"
+//     version      u16  ARCHIVE_VERSION
+//     entry size   u16  ARCHIVE_ENTRY_SIZE, readers skip fields added after the ones they know
+//     count        u32  entries
+//     reserved     u32
+//   count entries of entry size bytes each
+//     offset       u32  where the ROM starts, from the beginning of the file
+//     size         u32
+//     name offset  u32  the name isn't NUL terminated
+//     name length  u16
+//     quirks       u16  ARCHIVE_QUIRK_* the ROM expects
+//     variant      u8   chip8Variant
+//     flags        u8   ARCHIVE_HAS_HASH
+//     reserved     6 bytes
+//     cycles       u64  instructions a regression run executes
+//     seed         u64  for the CXNN random numbers
+//     hash         u64  chip8Framebuffer::hash() after the run, with ARCHIVE_HAS_HASH
+//   names and ROMs, anywhere after the table
+//
+// A regression run (play) starts a new machine with the seed, runs cycles instructions through
+// the frame scheduler at SCHEDULER_DEFAULT_IPS and hashes the screen.
+
+#define ARCHIVE_MAGIC "C8PK"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_HEADER_SIZE 16
+#define ARCHIVE_ENTRY_SIZE 48
+
+#define ARCHIVE_HAS_HASH 0x01
+
+// Quirk profile bits, the interpreter behaves like the original COSMAC VIP one so they are only
+// information for now
+#define ARCHIVE_QUIRK_SHIFT_VY		0x0001	// 8XY6/8XYE shift VX instead of VY
+#define ARCHIVE_QUIRK_LOAD_STORE_I	0x0002	// FX55/FX65 leave I unchanged
+#define ARCHIVE_QUIRK_JUMP_VX		0x0004	// BNNN jumps to XNN + VX
+#define ARCHIVE_QUIRK_WRAP_SPRITES	0x0008	// Sprites wrap around the screen edges instead of clipping
+#define ARCHIVE_QUIRK_VF_RESET		0x0010	// 8XY1/8XY2/8XY3 don't reset VF
+
+struct chip8ArchiveEntry
+{
+	std::string Name;
+	const uint8_t* Data;	// Into the archive's mapping when read from one
+	size_t Size;
+	uint16_t Quirks;
+	chip8Variant Variant;
+	bool HasHash;
+	uint64_t Cycles;
+	uint64_t Seed;
+	uint64_t Hash;
+};
+
+class chip8RomArchive
+{
+	public:
+		// Map an archive and check its table, false when it can't be used
+		bool open(const char* filename);
+		void close();
+
+		size_t size() const { return Entries.size(); }
+		const chip8ArchiveEntry& entry(size_t index) const { return Entries[index]; }
+		const chip8ArchiveEntry* find(const char* name) const;
+
+		// Run an entry on a new machine the way a regression run does, returns the framebuffer hash
+		static uint64_t play(const chip8ArchiveEntry& entry, chip8Engine engine = chip8Engine::Interpreter);
+
+		// Build an archive from entries whose Data points to their ROMs. Fails with a message when
+		// the archive would pass 4 GB or a name 64K, the table can't hold the offsets.
+		static bool write(std::vector<uint8_t>& out, const std::vector<chip8ArchiveEntry>& entries);
+
+	private:
+		chip8RomFile File;
+		std::vector<chip8ArchiveEntry> Entries;
+};
@@ -0,0 +1,124 @@
+#include "romfile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+chip8RomFile::chip8RomFile()
+{
+	Data = NULL;
+	Size = 0;
+	Open = false;
+#ifdef _WIN32
+	File = INVALID_HANDLE_VALUE;
+	Mapping = NULL;
+#endif
+}
+
+chip8RomFile::~chip8RomFile()
+{
+	close();
+}
+
+#ifdef _WIN32
+
+bool chip8RomFile::open(const char* filename)
+{
+	close();
+
+	File = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (File == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(File, &size))
+	{
+		close();
+		return false;
+	}
+
+	Size = (size_t)size.QuadPart;
+	Open = true;
+	if (Size == 0)
+		return true; // Nothing to map
+
+	Mapping = CreateFileMappingA(File, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (Mapping != NULL)
+		Data = (const uint8_t*)MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+	if (Data == NULL)
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void chip8RomFile::close()
+{
+	if (Data != NULL)
+		UnmapViewOfFile(Data);
+	if (Mapping != NULL)
+		CloseHandle(Mapping);
+	if (File != INVALID_HANDLE_VALUE)
+		CloseHandle(File);
+
+	Data = NULL;
+	Size = 0;
+	Open = false;
+	File = INVALID_HANDLE_VALUE;
+	Mapping = NULL;
+}
+
+#else
+
+bool chip8RomFile::open(const char* filename)
+{
+	close();
+
+	const int file = ::open(filename, O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(file, &info) != 0 || !S_ISREG(info.st_mode))
+	{
+		::close(file);
+		return false;
+	}
+
+	Size = (size_t)info.st_size;
+	if (Size > 0)
+	{
+		void* data = mmap(NULL, Size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (data == MAP_FAILED)
+		{
+			::close(file);
+			Size = 0;
+			return false;
+		}
+		Data = (const uint8_t*)data;
+	}
+
+	// The mapping keeps the file alive
+	::close(file);
+	Open = true;
+	return true;
+}
+
+void chip8RomFile::close()
+{
+	if (Data != NULL)
+		munmap((void*)Data, Size);
+
+	Data = NULL;
+	Size = 0;
+	Open = false;
+}
+
+#endif
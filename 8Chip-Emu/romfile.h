@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+
+// Read-only view of a whole file
+// The file is mapped into memory (mmap, or a file mapping on Windows) so loading a ROM copies its
+// bytes once, straight from the page cache into the machine's memory, instead of reading them into
+// a buffer first. Empty files are fine, data() is NULL for them.
+
+class chip8RomFile
+{
+	public:
+		chip8RomFile();
+		~chip8RomFile();
+
+		bool open(const char* filename);
+		void close();
+
+		const uint8_t* data() const { return Data; }
+		size_t size() const { return Size; }
+		bool isOpen() const { return Open; }
+
+	private:
+		chip8RomFile(const chip8RomFile&);				// A mapping has a single owner
+		chip8RomFile& operator=(const chip8RomFile&);
+
+		const uint8_t* Data;
+		size_t Size;
+		bool Open;
+#ifdef _WIN32
+		void* File;		// HANDLE of the file...
+		void* Mapping;	// ...and of its mapping
+#endif
+};
+
+// fopen for everything else the core and the tools read and write, NULL when it fails
+inline FILE* openFile(const char* filename, const char* mode)
+{
+	FILE* pFile;
+#ifdef _MSC_VER
+	if (fopen_s(&pFile, filename, mode) != 0)
+		pFile = NULL;
+#else
+	pFile = fopen(filename, mode); // fopen_s is only available on MSVC
+#endif
+	return pFile;
+}
@@ -0,0 +1,176 @@
+#include "romindex.h"
+#include "romfile.h"
+#include <stdio.h>
+
+static uint64_t hashBytes(const uint8_t* data, size_t size)
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t n = 0; n < size; n++)
+	{
+		hash ^= data[n];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static int kinds(uint32_t bits)
+{
+	int n = 0;
+	for (; bits != 0; bits &= bits - 1)
+		n++;
+	return n;
+}
+
+chip8RomIndex::chip8RomIndex()
+{
+	Hits = 0;
+	Misses = 0;
+}
+
+chip8Variant chip8RomIndex::detectVariant(const uint8_t* data, size_t size)
+{
+	// Sprites and other data look like opcodes too, a single odd opcode doesn't decide it.
+	// Bit n is set for every kind of extension opcode seen.
+	uint32_t super = 0, xo = 0;
+	for (size_t n = 0; n + 1 < size; n += 2)
+	{
+		const uint16_t opcode = (uint16_t)(data[n] << 8 | data[n + 1]);
+		const uint8_t nn = opcode & 0xFF;
+
+		switch (opcode >> 12)
+		{
+		case 0x0:
+			if ((opcode & 0xFFF0) == 0x00C0 && (opcode & 0xF) != 0)
+				super |= 1 << 0;	// 00CN scroll down
+			else if (opcode >= 0x00FB && opcode <= 0x00FF)
+				super |= 1 << (opcode - 0x00FB + 1);	// Scroll right/left, exit, lores, hires
+			else if ((opcode & 0xFFF0) == 0x00D0)
+				xo |= 1 << 0;		// 00DN scroll up
+			break;
+		case 0x5:
+			if ((opcode & 0xF) == 2 || (opcode & 0xF) == 3)
+				xo |= 1 << (opcode & 0xF);	// Save and load a register range
+			break;
+		case 0xD:
+			if ((opcode & 0xF) == 0)
+				super |= 1 << 6;	// 16x16 sprite
+			break;
+		case 0xF:
+			if (opcode == 0xF000)
+				xo |= 1 << 4;		// I = NNNN
+			else if (nn == 0x01)
+				xo |= 1 << 5;		// Plane
+			else if (opcode == 0xF002)
+				xo |= 1 << 6;		// Audio pattern
+			else if (nn == 0x30)
+				super |= 1 << 7;	// Big font
+			else if (nn == 0x75 || nn == 0x85)
+				super |= 1 << 8;	// Flags registers
+			break;
+		}
+	}
+
+	// Two different kinds are hard to get from data alone
+	if (kinds(xo) >= 2)
+		return chip8Variant::XoChip;
+	if (kinds(super) >= 2)
+		return chip8Variant::SuperChip;
+	return chip8Variant::Chip8;
+}
+
+const char* chip8RomIndex::variantName(chip8Variant variant)
+{
+	switch (variant)
+	{
+	case chip8Variant::SuperChip: return "schip";
+	case chip8Variant::XoChip: return "xo-chip";
+	default: return "chip8";
+	}
+}
+
+const chip8RomInfo* chip8RomIndex::add(const char* name, const uint8_t* data, size_t size)
+{
+	if (size > WORKING_RAM_MAX_AMOUNT)
+	{
+		fprintf(stderr, "Error: %s is too big for memory\n", name);
+		return NULL;
+	}
+
+	const uint64_t hash = hashBytes(data, size);
+	{
+		std::lock_guard<std::mutex> lock(Lock);
+		auto same = Hashes.find(hash);
+		if (same != Hashes.end() && same->second->Size == size)
+		{
+			Names[name] = same->second;
+			return same->second;
+		}
+	}
+
+	// Outside the lock, other threads can keep using the index meanwhile
+	chip8 loader;
+	if (!loader.loadApplication(data, size))
+		return NULL;
+
+	chip8RomInfo info;
+	info.Hash = hash;
+	info.Size = size;
+	info.Variant = detectVariant(data, size);
+	info.Image = loader.getImage();
+	info.ImageHash = loader.getImageHash();
+
+	std::lock_guard<std::mutex> lock(Lock);
+	auto same = Hashes.find(hash);
+	const chip8RomInfo* entry;
+	if (same != Hashes.end() && same->second->Size == size)
+		entry = same->second; // Another thread got here first
+	else
+	{
+		Roms.push_back(info);
+		entry = &Roms.back();
+		Hashes.emplace(hash, entry);
+	}
+	Names[name] = entry;
+	return entry;
+}
+
+const chip8RomInfo* chip8RomIndex::find(const char* filename)
+{
+	{
+		std::lock_guard<std::mutex> lock(Lock);
+		auto known = Names.find(filename);
+		if (known != Names.end())
+		{
+			Hits++;
+			return known->second;
+		}
+		Misses++;
+	}
+
+	chip8RomFile file;
+	if (!file.open(filename))
+	{
+		fprintf(stderr, "Could not open %s\n", filename);
+		return NULL;
+	}
+
+	return add(filename, file.data(), file.size());
+}
+
+bool chip8RomIndex::load(chip8& machine, const char* filename)
+{
+	const chip8RomInfo* rom = find(filename);
+	if (rom == NULL)
+		return false;
+
+	machine.loadImage(rom->Image, rom->ImageHash);
+	return true;
+}
+
+size_t chip8RomIndex::size()
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	return Roms.size();
+}
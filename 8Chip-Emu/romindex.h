@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include "chip8.h"
+
+// Index of the ROMs a process has loaded
+// The first time a ROM is asked for its file is mapped, checked and loaded into a memory image
+// once, together with a hash of its bytes, its size and a guess of the platform it was written for.
+// Every later load of the same file, or of another file with the same bytes, is a copy of that
+// image sharing all of its pages (see pagedmemory.h): no file access, no copying, no hashing.
+// Safe to use from several threads.
+
+enum class chip8Variant
+{
+	Chip8,
+	SuperChip,	// Uses SCHIP opcodes (scrolling, hires, FX30/FX75...)
+	XoChip		// Uses XO-CHIP opcodes (F000 NNNN, planes, 5XY2/5XY3...)
+};
+
+struct chip8RomInfo
+{
+	uint64_t Hash;			// FNV-1a of the ROM bytes
+	size_t Size;
+	chip8Variant Variant;
+	chip8Memory Image;		// Memory of a machine that loaded the ROM
+	uint64_t ImageHash;
+};
+
+class chip8RomIndex
+{
+	public:
+		chip8RomIndex();
+
+		// The entry of a ROM file, indexing it the first time. NULL when the file can't be read or
+		// doesn't fit in memory.
+		const chip8RomInfo* find(const char* filename);
+
+		// Index a ROM that is already in memory under a name
+		const chip8RomInfo* add(const char* name, const uint8_t* data, size_t size);
+
+		// Load a ROM into a freshly initialized machine, like chip8::loadApplication
+		bool load(chip8& machine, const char* filename);
+
+		size_t size();	// Distinct ROMs indexed
+
+		uint64_t Hits;		// find() calls answered from the index
+		uint64_t Misses;	// find() calls that had to read the file
+
+		static chip8Variant detectVariant(const uint8_t* data, size_t size);
+		static const char* variantName(chip8Variant variant);
+
+	private:
+		std::mutex Lock;
+		std::deque<chip8RomInfo> Roms;	// Entries never move once added
+		std::unordered_map<uint64_t, const chip8RomInfo*> Hashes;
+		std::unordered_map<std::string, const chip8RomInfo*> Names;
+};
@@ -0,0 +1,127 @@
+#include "scheduler.h"
+#include "movie.h"
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#pragma comment(lib, "winmm.lib")
+#endif
+
+// sleep_for can wake up late by about a scheduler slice, the end of each wait is spent yielding instead
+static const std::chrono::microseconds SleepSlack(2000);
+
+// Frames behind schedule before pacing restarts from the current time
+static const uint64_t MaxLagFrames = 5;
+
+chip8Scheduler::chip8Scheduler(chip8& machine, uint32_t instructionsPerSecond) : Machine(machine)
+{
+	Frames = 0;
+	LateFrames = 0;
+	FrameCycles = 0;
+	Movie = NULL;
+	setSpeed(instructionsPerSecond);
+	resync();
+
+#ifdef _WIN32
+	// The default Windows timer resolution (15.6 ms) is about a whole frame
+	timeBeginPeriod(1);
+#endif
+}
+
+chip8Scheduler::~chip8Scheduler()
+{
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+}
+
+void chip8Scheduler::setSpeed(uint32_t instructionsPerSecond)
+{
+	if (instructionsPerSecond < SCHEDULER_MIN_IPS)
+		instructionsPerSecond = SCHEDULER_MIN_IPS;
+	if (instructionsPerSecond > SCHEDULER_MAX_IPS)
+		instructionsPerSecond = SCHEDULER_MAX_IPS;
+
+	Speed = instructionsPerSecond;
+}
+
+uint64_t chip8Scheduler::frameBudget() const
+{
+	// Spread the remainder of Speed / 60 over the frames so a second always runs Speed instructions
+	const uint64_t frame = Frames % SCHEDULER_FRAME_RATE;
+	return (frame + 1) * Speed / SCHEDULER_FRAME_RATE - frame * Speed / SCHEDULER_FRAME_RATE;
+}
+
+uint64_t chip8Scheduler::runFrame(uint64_t maxCycles)
+{
+	const uint64_t budget = frameBudget();
+	uint64_t executed = 0;
+	bool drawn = false;
+
+	// run() returns at every draw, keep going until the frame is done
+	while (FrameCycles < budget && executed < maxCycles)
+	{
+		uint64_t left = budget - FrameCycles < maxCycles - executed ? budget - FrameCycles : maxCycles - executed;
+
+		// Stop at the next key change of a movie
+		if (Movie != NULL)
+		{
+			const uint64_t next = Movie->apply(Machine);
+			if (next < left)
+				left = next;
+		}
+
+		const uint64_t n = Machine.run(left);
+		FrameCycles += n;
+		executed += n;
+
+		if (Machine.DrawFlag)
+		{
+			drawn = true;
+			Machine.DrawFlag = false;
+		}
+	}
+
+	if (FrameCycles >= budget)
+	{
+		Machine.tickTimers();
+		FrameCycles = 0;
+		Frames++;
+	}
+
+	Machine.DrawFlag = drawn;
+	return executed;
+}
+
+void chip8Scheduler::waitForFrame()
+{
+	PacedFrames++;
+
+	// Deadlines are computed from Start so rounding errors don't accumulate
+	const Clock::time_point deadline = Start + std::chrono::nanoseconds(PacedFrames * 1000000000ULL / SCHEDULER_FRAME_RATE);
+	Clock::time_point now = Clock::now();
+
+	if (now >= deadline)
+	{
+		LateFrames++;
+		if (now - deadline > std::chrono::nanoseconds(MaxLagFrames * 1000000000ULL / SCHEDULER_FRAME_RATE))
+			resync();
+		return;
+	}
+
+	while (now < deadline)
+	{
+		if (deadline - now > SleepSlack)
+			std::this_thread::sleep_for(deadline - now - SleepSlack);
+		else
+			std::this_thread::yield();
+
+		now = Clock::now();
+	}
+}
+
+void chip8Scheduler::resync()
+{
+	Start = Clock::now();
+	PacedFrames = 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+#include <chrono>
+#include "chip8.h"
+
+class chip8Movie;
+
+// Frame scheduler for the chip8 core
+// Splits emulated time into 60 Hz frames: every frame runs a configurable number of instructions,
+// ticks the delay and sound timers once and then, when pacing in real time, sleeps until the next
+// frame is due. The host only has to present and poll events once per frame instead of after
+// every instruction, and the emulation speed no longer depends on how fast the host loop spins.
+
+#define SCHEDULER_FRAME_RATE 60			// Timer and frame frequency in Hz
+#define SCHEDULER_DEFAULT_IPS 700		// Instructions per second, close to the original hardware
+#define SCHEDULER_MIN_IPS SCHEDULER_FRAME_RATE	// At least one instruction per frame
+#define SCHEDULER_MAX_IPS 1000000000
+
+class chip8Scheduler
+{
+	public:
+		chip8Scheduler(chip8& machine, uint32_t instructionsPerSecond = SCHEDULER_DEFAULT_IPS);
+		~chip8Scheduler();
+
+		// Instructions per second, clamped to [SCHEDULER_MIN_IPS, SCHEDULER_MAX_IPS].
+		// Frames get a whole number of instructions each but they add up to exactly this rate.
+		void setSpeed(uint32_t instructionsPerSecond);
+		uint32_t getSpeed() const { return Speed; }
+
+		// Run the rest of the current frame, at most maxCycles instructions. When the frame is
+		// complete the timers tick and Frames goes up. DrawFlag is left set if anything was drawn.
+		// Returns the instructions executed.
+		uint64_t runFrame(uint64_t maxCycles = UINT64_MAX);
+
+		// Sleep until the next frame is due. If the host falls too far behind the schedule is
+		// restarted instead of running a burst of frames to catch up.
+		void waitForFrame();
+
+		// Replay an input movie, its keys are set exactly at the cycles they were recorded at.
+		// NULL stops replaying.
+		void play(chip8Movie* movie) { Movie = movie; }
+
+		// Start pacing from now, call after a pause (loading, a modal dialog...)
+		void resync();
+
+		uint64_t Frames;		// Completed frames
+		uint64_t LateFrames;	// Frames that started after their deadline
+
+	private:
+		typedef std::chrono::steady_clock Clock;
+
+		chip8& Machine;
+		uint32_t Speed;
+		uint64_t FrameCycles;		// Instructions already run in the current frame
+		uint64_t PacedFrames;		// Frames waited for since Start
+		Clock::time_point Start;	// When pacing (re)started
+		chip8Movie* Movie;			// Replayed input, NULL when the keys come from the host
+
+		uint64_t frameBudget() const;
+};
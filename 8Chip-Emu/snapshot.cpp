@@ -0,0 +1,288 @@
+#include "chip8.h"
+#include "snapshot.h"
+#include <string.h>
+#include <stdio.h>
+
+// Little endian writers, the format doesn't depend on the host byte order
+static void put8(std::vector<uint8_t>& out, uint8_t value)
+{
+	out.push_back(value);
+}
+
+static void put16(std::vector<uint8_t>& out, uint16_t value)
+{
+	out.push_back((uint8_t)value);
+	out.push_back((uint8_t)(value >> 8));
+}
+
+static void put64(std::vector<uint8_t>& out, uint64_t value)
+{
+	for (int b = 0; b < 8; b++)
+		out.push_back((uint8_t)(value >> (8 * b)));
+}
+
+// Reads a snapshot front to back, every read past the end fails the whole restore
+struct SnapshotReader
+{
+	const uint8_t* Data;
+	size_t Size;
+	size_t Offset;
+	bool Ok;
+
+	bool has(size_t n)
+	{
+		Ok = Ok && Size - Offset >= n;
+		return Ok;
+	}
+
+	uint8_t get8()
+	{
+		return has(1) ? Data[Offset++] : 0;
+	}
+
+	uint16_t get16()
+	{
+		if (!has(2))
+			return 0;
+		const uint16_t value = (uint16_t)(Data[Offset] | Data[Offset + 1] << 8);
+		Offset += 2;
+		return value;
+	}
+
+	uint64_t get64()
+	{
+		if (!has(8))
+			return 0;
+		uint64_t value = 0;
+		for (int b = 0; b < 8; b++)
+			value |= (uint64_t)Data[Offset + b] << (8 * b);
+		Offset += 8;
+		return value;
+	}
+
+	const uint8_t* bytes(size_t n)
+	{
+		if (!has(n))
+			return NULL;
+		const uint8_t* p = Data + Offset;
+		Offset += n;
+		return p;
+	}
+};
+
+uint64_t chip8::hashMemory(const chip8Memory& memory)
+{
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (int p = 0; p < MEMORY_PAGES; p++)
+	{
+		const uint8_t* bytes = memory.page(p);
+		for (int n = 0; n < MEMORY_PAGE_SIZE; n++)
+		{
+			hash ^= bytes[n];
+			hash *= 0x100000001b3ULL;
+		}
+	}
+
+	return hash;
+}
+
+void chip8::snapshot(std::vector<uint8_t>& out, bool delta) const
+{
+	out.clear();
+	out.reserve(delta ? 512 : 4096 + 512);
+
+	out.insert(out.end(), SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 4);
+	put16(out, SNAPSHOT_VERSION);
+	put16(out, delta ? SNAPSHOT_DELTA : 0);
+	put16(out, GFX_WIDTH);
+	put16(out, GFX_HEIGHT);
+
+	put16(out, PC);
+	put16(out, OPCode);
+	put16(out, I);
+	put16(out, SP);
+	out.insert(out.end(), V, V + 16);
+	for (int n = 0; n < 16; n++)
+		put16(out, Stack[n]);
+	put8(out, DelayTimer);
+	put8(out, SoundTimer);
+
+	put16(out, getKeys());
+	put8(out, WaitKey);
+	put8(out, DrawFlag ? 1 : 0);
+	put64(out, CycleCount);
+	put64(out, RandomState);
+
+	for (int y = 0; y < GFX_HEIGHT; y++)
+		for (int w = 0; w < GFX_ROW_WORDS; w++)
+			put64(out, GFX.row(y)[w]);
+
+	if (!delta)
+	{
+		for (int p = 0; p < MEMORY_PAGES; p++)
+			out.insert(out.end(), Memory.page(p), Memory.page(p) + MEMORY_PAGE_SIZE);
+		return;
+	}
+
+	put64(out, ImageHash);
+	const size_t countAt = out.size();
+	put16(out, 0); // Run count, filled in below
+
+	uint16_t runs = 0;
+	size_t n = 0;
+	while (n < MEMORY_SIZE)
+	{
+		// Pages nothing wrote to are still the image's own pages
+		if (n % MEMORY_PAGE_SIZE == 0 && Memory.samePage(Image, (int)(n / MEMORY_PAGE_SIZE)))
+		{
+			n += MEMORY_PAGE_SIZE;
+			continue;
+		}
+
+		// The rest of a written page is mostly unchanged too, skip it a word at a time
+		const size_t offset = n % MEMORY_PAGE_SIZE;
+		if (offset + 8 <= MEMORY_PAGE_SIZE && memcmp(Memory.page((int)(n / MEMORY_PAGE_SIZE)) + offset, Image.page((int)(n / MEMORY_PAGE_SIZE)) + offset, 8) == 0)
+		{
+			n += 8;
+			continue;
+		}
+		if (Memory[(uint16_t)n] == Image[(uint16_t)n])
+		{
+			n++;
+			continue;
+		}
+
+		// Extend the run over short stretches of equal bytes, a new run would cost more
+		size_t end = n + 1;
+		size_t last = n;
+		while (end < MEMORY_SIZE && end - last <= SNAPSHOT_RUN_GAP)
+		{
+			if (Memory[(uint16_t)end] != Image[(uint16_t)end])
+				last = end;
+			end++;
+		}
+
+		const size_t length = last - n + 1;
+		put16(out, (uint16_t)n);
+		put16(out, (uint16_t)length);
+		const size_t at = out.size();
+		out.resize(at + length);
+		Memory.read((uint16_t)n, out.data() + at, length);
+		runs++;
+
+		n = last + 1;
+	}
+
+	out[countAt] = (uint8_t)runs;
+	out[countAt + 1] = (uint8_t)(runs >> 8);
+}
+
+bool chip8::restore(const uint8_t* data, size_t size)
+{
+	SnapshotReader in = { data, size, 0, true };
+
+	const uint8_t* magic = in.bytes(4);
+	if (magic == NULL || memcmp(magic, SNAPSHOT_MAGIC, 4) != 0)
+	{
+		fputs("Not a save state\n", stderr);
+		return false;
+	}
+
+	const uint16_t version = in.get16();
+	const uint16_t flags = in.get16();
+	const uint16_t width = in.get16();
+	const uint16_t height = in.get16();
+	if (!in.Ok || version < SNAPSHOT_MIN_VERSION || version > SNAPSHOT_VERSION || width != GFX_WIDTH || height != GFX_HEIGHT)
+	{
+		fprintf(stderr, "Save state version %u (%ux%u) isn't supported\n", version, width, height);
+		return false;
+	}
+
+	// Everything is read into locals first so a broken snapshot doesn't leave a half restored machine
+	const uint16_t pc = in.get16();
+	const uint16_t opcode = in.get16();
+	const uint16_t index = in.get16();
+	const uint16_t sp = in.get16();
+	const uint8_t* v = in.bytes(16);
+	uint16_t stack[16];
+	for (int n = 0; n < 16; n++)
+		stack[n] = in.get16();
+	const uint8_t delayTimer = in.get8();
+	const uint8_t soundTimer = in.get8();
+	const uint16_t keys = in.get16();
+	const uint8_t waitKey = version >= 2 ? in.get8() : 0xFF;
+	const uint8_t drawFlag = in.get8();
+	const uint64_t cycleCount = in.get64();
+	const uint64_t randomState = in.get64();
+
+	uint64_t rows[GFX_HEIGHT * GFX_ROW_WORDS];
+	for (int w = 0; w < GFX_HEIGHT * GFX_ROW_WORDS; w++)
+		rows[w] = in.get64();
+
+	// The runs are only checked here and copied once the whole state is known to be good
+	const uint8_t* memory = NULL;
+	uint16_t runs = 0;
+	size_t runsAt = 0;
+	if (flags & SNAPSHOT_DELTA)
+	{
+		const uint64_t imageHash = in.get64();
+		if (in.Ok && imageHash != ImageHash)
+		{
+			fputs("The save state was made with another ROM\n", stderr);
+			return false;
+		}
+
+		runs = in.get16();
+		runsAt = in.Offset;
+		for (uint16_t r = 0; r < runs && in.Ok; r++)
+		{
+			const uint16_t offset = in.get16();
+			const uint16_t length = in.get16();
+			if (in.bytes(length) == NULL || (size_t)offset + length > MEMORY_SIZE)
+				in.Ok = false;
+		}
+	}
+	else
+		memory = in.bytes(MEMORY_SIZE);
+
+	if (!in.Ok || sp > 0xF || (waitKey > 0xF && waitKey != 0xFF))
+	{
+		fputs("The save state is truncated or corrupt\n", stderr);
+		return false;
+	}
+
+	PC = pc;
+	OPCode = opcode;
+	I = index;
+	SP = sp;
+	memcpy(V, v, sizeof(V));
+	memcpy(Stack, stack, sizeof(Stack));
+	DelayTimer = delayTimer;
+	SoundTimer = soundTimer;
+	for (int k = 0; k < 16; k++)
+		Key[k] = keys >> k & 1;
+	WaitKey = waitKey;
+	IdlePC = 0xFFFF;
+	DrawFlag = drawFlag != 0;
+	CycleCount = cycleCount;
+	setRandomState(randomState);
+
+	GFX.setRows(rows); // Marks the whole screen dirty so it gets uploaded again
+
+	// Start from the image so the pages the state didn't change stay shared with it
+	Memory = Image;
+	if (memory != NULL)
+		Memory.assign(memory);
+
+	SnapshotReader delta = { data, size, runsAt, true };
+	for (uint16_t r = 0; r < runs; r++)
+	{
+		const uint16_t offset = delta.get16();
+		const uint16_t length = delta.get16();
+		Memory.write(offset, delta.bytes(length), length);
+	}
+	flushCode(); // The code may be a different one now
+
+	return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+
+// Save state format written by chip8::snapshot and read by chip8::restore
+// Everything is little endian and packed, no padding:
+//
+//   magic        4 bytes "C8SS"
+//   version      u16  SNAPSHOT_VERSION, restore also reads the older versions down to SNAPSHOT_MIN_VERSION
+//   flags        u16  SNAPSHOT_DELTA when the memory is stored as a delta
+//   width        u16  GFX_WIDTH of the machine that wrote it
+//   height       u16  GFX_HEIGHT
+//   PC, OPCode, I, SP                  u16 each
+//   V[16]                              16 bytes
+//   Stack[16]                          u16 each
+//   DelayTimer, SoundTimer             u8 each
+//   keys         u16  bit n is Key[n]
+//   WaitKey      u8   key an FX0A waits to be released, 0xFF when none. Since version 2, version 1
+//                     states restore with 0xFF.
+//   DrawFlag     u8
+//   CycleCount   u64
+//   RandomState  u64
+//   framebuffer  height * GFX_ROW_WORDS u64, row after row, leftmost pixel in the top bit
+//   memory, either
+//     4096 bytes                                          without SNAPSHOT_DELTA
+//     image hash u64, run count u16, then for every run   with SNAPSHOT_DELTA
+//       offset u16, length u16, length bytes
+//
+// A delta lists the runs of memory that differ from the ROM image the machine loaded, a machine
+// that has been playing for a while usually only changed a few hundred bytes of variables.
+// Restoring a delta needs a machine that loaded the same ROM, the image hash checks that.
+
+#define SNAPSHOT_MAGIC "C8SS"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_MIN_VERSION 1
+#define SNAPSHOT_DELTA 0x0001
+
+// Equal bytes between two changed runs that are still stored to save a run header (4 bytes)
+#define SNAPSHOT_RUN_GAP 4
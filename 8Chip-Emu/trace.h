@@ -0,0 +1,159 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "romfile.h"
+
+// Opcode tracing for the chip8 core
+// The tracer is selected at compile time: with CHIP8_TRACE set to 0 every call is an empty inline
+// function so the interpreter runs at full speed, with CHIP8_TRACE set to 1 the executed
+// instructions are kept in an in-memory ring buffer that can be printed or dumped to a binary file.
+// Tracing is opt-in in every configuration, it turns off the JIT and idle loop skipping and adds a
+// ring buffer to every machine, so Debug builds would otherwise run differently from Release.
+
+#ifndef CHIP8_TRACE
+#define CHIP8_TRACE 0
+#endif
+
+// How important an event is, events above the tracer level are dropped
+enum class TraceLevel : uint8_t
+{
+	Error = 0,
+	Warning,
+	Info,
+	Verbose
+};
+
+// What part of the machine produced the event, used as a bit mask to filter events
+enum TraceCategory : uint8_t
+{
+	TRACE_CPU   = 0x01,	// Instruction execution
+	TRACE_ALL   = 0xFF
+};
+
+// A single trace record, 16 bytes so the ring buffer stays compact
+struct TraceEvent
+{
+	uint64_t Cycle;		// Instruction count when the event happened
+	uint16_t PC;		// Program counter of the instruction
+	uint16_t OPCode;	// Instruction being executed
+	uint16_t I;			// Index register before execution
+	uint8_t  Level;
+	uint8_t  Category;
+};
+
+template <bool Enabled>
+class chip8Trace;
+
+// Tracing compiled out, everything folds away
+template <>
+class chip8Trace<false>
+{
+	public:
+		static const bool Enabled = false;
+
+		void setLevel(TraceLevel) {}
+		void setCategories(uint8_t) {}
+		void setEcho(bool) {}
+		bool wants(TraceLevel, uint8_t) const { return false; }
+		void record(TraceLevel, uint8_t, uint64_t, uint16_t, uint16_t, uint16_t) {}
+		void clear() {}
+		size_t size() const { return 0; }
+		void print(FILE*) const {}
+		bool dumpBinary(const char*) const { return false; }
+};
+
+// Tracing compiled in, events go to a ring buffer that keeps the most recent ones
+template <>
+class chip8Trace<true>
+{
+	public:
+		static const bool Enabled = true;
+
+		// Capacity must be a power of two so the ring index is a mask
+		explicit chip8Trace(size_t capacity = 1 << 16)
+			: Events(capacity), Mask(capacity - 1), Head(0), Count(0),
+			  Level(TraceLevel::Verbose), Categories(TRACE_ALL), Echo(false)
+		{
+		}
+
+		void setLevel(TraceLevel level) { Level = level; }
+		void setCategories(uint8_t categories) { Categories = categories; }
+		void setEcho(bool echo) { Echo = echo; } // Also print every event as it is recorded
+
+		bool wants(TraceLevel level, uint8_t category) const
+		{
+			return level <= Level && (category & Categories) != 0;
+		}
+
+		void record(TraceLevel level, uint8_t category, uint64_t cycle, uint16_t pc, uint16_t opcode, uint16_t i)
+		{
+			if (!wants(level, category))
+				return;
+
+			TraceEvent& e = Events[Head & Mask];
+			e.Cycle = cycle;
+			e.PC = pc;
+			e.OPCode = opcode;
+			e.I = i;
+			e.Level = (uint8_t)level;
+			e.Category = category;
+			Head++;
+			if (Count < Events.size())
+				Count++;
+
+			if (Echo)
+				printEvent(stdout, e);
+		}
+
+		void clear()
+		{
+			Head = 0;
+			Count = 0;
+		}
+
+		size_t size() const { return Count; }
+
+		// Print the buffered events from oldest to newest
+		void print(FILE* out) const
+		{
+			for (size_t n = 0; n < Count; n++)
+				printEvent(out, Events[(Head - Count + n) & Mask]);
+		}
+
+		// Binary dump: "C8TR", format version, event count and the events from oldest to newest
+		bool dumpBinary(const char* filename) const
+		{
+			FILE* pFile = openFile(filename, "wb");
+			if (pFile == NULL)
+				return false;
+
+			const uint32_t version = 1;
+			const uint64_t count = Count;
+			bool ok = fwrite("C8TR", 1, 4, pFile) == 4
+				&& fwrite(&version, sizeof(version), 1, pFile) == 1
+				&& fwrite(&count, sizeof(count), 1, pFile) == 1;
+
+			for (size_t n = 0; ok && n < Count; n++)
+				ok = fwrite(&Events[(Head - Count + n) & Mask], sizeof(TraceEvent), 1, pFile) == 1;
+
+			fclose(pFile);
+			return ok;
+		}
+
+	private:
+		std::vector<TraceEvent> Events;
+		size_t Mask;
+		size_t Head;	// Total number of events recorded, the next slot is Head & Mask
+		size_t Count;	// Number of valid events in the buffer
+		TraceLevel Level;
+		uint8_t Categories;
+		bool Echo;
+
+		static void printEvent(FILE* out, const TraceEvent& e)
+		{
+			fprintf(out, "%10llu PC: %#05x OPCode: %#06x I: %#05x\n", (unsigned long long)e.Cycle, e.PC, e.OPCode, e.I);
+		}
+};
+
+typedef chip8Trace<CHIP8_TRACE != 0> Trace;
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+
+// Lock-free triple buffer between one producer and one consumer thread
+// The producer always has a slot of its own to write the next item into and the consumer always has
+// one to read from, the third slot holds the newest published item. Publishing and picking up swap
+// slot indices with a single atomic exchange, neither side ever waits for the other. Items the
+// consumer was too slow to pick up are overwritten by newer ones.
+
+template<typename T>
+class chip8TripleBuffer
+{
+	public:
+		chip8TripleBuffer() : State(1), Back(2), Front(0) {}
+
+		// Producer: slot to fill with the next item
+		T& back() { return Slots[Back]; }
+
+		// Producer: make back() the newest item and get a fresh slot for the next one
+		void publish()
+		{
+			const uint8_t old = State.exchange((uint8_t)(Back | FRESH), std::memory_order_acq_rel);
+			Back = old & INDEX;
+		}
+
+		// True while the last published item hasn't been picked up, may turn false at any moment
+		bool unread() const { return (State.load(std::memory_order_acquire) & FRESH) != 0; }
+
+		// Consumer: move to the newest published item, returns false when there is nothing new
+		bool update()
+		{
+			if ((State.load(std::memory_order_relaxed) & FRESH) == 0)
+				return false;
+
+			const uint8_t old = State.exchange(Front, std::memory_order_acq_rel);
+			Front = old & INDEX;
+			return true;
+		}
+
+		// Consumer: the item picked up by the last successful update()
+		const T& front() const { return Slots[Front]; }
+
+	private:
+		enum { INDEX = 0x3, FRESH = 0x4 };
+
+		T Slots[3];
+		alignas(64) std::atomic<uint8_t> State;	// Index of the middle slot and FRESH when it wasn't picked up yet
+		alignas(64) uint8_t Back;				// Only touched by the producer
+		alignas(64) uint8_t Front;				// Only touched by the consumer
+};
@@ -0,0 +1,324 @@
+// My 8 Chip-Emu headless runner
+// Drives the chip8 interpreter without a window or a GL context so ROMs can be
+// run in bulk on display-less machines and the raw interpreter throughput measured.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "chip8.h"
+#include "blockcache.h"
+#include "jit.h"
+#include "scheduler.h"
+#include "movie.h"
+#include "romarchive.h"
+#include "romfile.h"
+
+// Default amount of work when neither -c nor -f is given
+#define DEFAULT_CYCLES 1000000
+
+static void printUsage()
+{
+	printf("usage: 8chip-headless.exe -a archive [-e engine]\n");
+	printf("       8chip-headless.exe chip8app [-c cycles] [-f frames] [-s ips] [-p] [-n] [-e engine] [-r seed] [-l state] [-w state] [-m movie] [-t tracefile] [-g stackfile]\n\n");
+	printf("  -a archive  Regression run of every ROM in an archive made by 8chip-pack, checking the expected screens\n");
+	printf("  -c cycles   Run this many instructions (default %d)\n", DEFAULT_CYCLES);
+	printf("  -f frames   Run this many 60 Hz frames\n");
+	printf("  -s ips      Emulated instructions per second, sets how often the timers tick (default %d)\n", SCHEDULER_DEFAULT_IPS);
+	printf("  -p          Pace the frames in real time instead of running as fast as possible\n");
+	printf("  -n          Run idle loops instruction by instruction instead of skipping them\n");
+	printf("  -e engine   interpreter (default), block or jit\n");
+	printf("  -r seed     Seed for the CXNN random numbers, the same seed gives the same run (default a new one every run)\n");
+	printf("  -l file     Continue from a save state instead of starting the ROM from the beginning\n");
+	printf("  -w file     Write a save state when done\n");
+	printf("  -m file     Replay an input movie from its start to where the recording stopped, at its speed\n");
+	printf("  -t file     Dump the opcode trace to a binary file (needs a CHIP8_TRACE build)\n");
+	printf("  -g file     Write the instruction profile as folded stacks for a flame graph (needs a CHIP8_PROFILE build)\n");
+}
+
+static bool parseEngine(const char* name, chip8Engine& engine)
+{
+	if (strcmp(name, "interpreter") == 0)
+		engine = chip8Engine::Interpreter;
+	else if (strcmp(name, "block") == 0)
+		engine = chip8Engine::BlockCache;
+	else if (strcmp(name, "jit") == 0)
+		engine = chip8Engine::Jit;
+	else
+		return false;
+
+	return true;
+}
+
+// Pixels in the rectangle the renderer uploads for a dirty region
+static uint64_t dirtyArea(const chip8DirtyRegion& dirty)
+{
+	if (dirty.empty())
+		return 0;
+
+	int top = 0, bottom = GFX_HEIGHT - 1;
+	while ((dirty.Rows >> top & 1) == 0)
+		top++;
+	while ((dirty.Rows >> bottom & 1) == 0)
+		bottom--;
+
+	return (uint64_t)(bottom - top + 1) * (dirty.Right - dirty.Left + 1);
+}
+
+static bool readFile(const char* filename, std::vector<uint8_t>& data)
+{
+	FILE* pFile = openFile(filename, "rb");
+	if (pFile == NULL)
+		return false;
+
+	uint8_t buffer[4096];
+	size_t n;
+	data.clear();
+	while ((n = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+		data.insert(data.end(), buffer, buffer + n);
+
+	fclose(pFile);
+	return true;
+}
+
+static bool writeFile(const char* filename, const std::vector<uint8_t>& data)
+{
+	FILE* pFile = openFile(filename, "wb");
+	if (pFile == NULL)
+		return false;
+
+	const bool written = fwrite(data.data(), 1, data.size(), pFile) == data.size();
+	return fclose(pFile) == 0 && written;
+}
+
+// Plays every ROM of an archive the way the packer did and compares the screens they end with
+static int runArchive(int argc, char** argv)
+{
+	chip8Engine engine = chip8Engine::Interpreter;
+	for (int i = 3; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-e") == 0 && i + 1 < argc && parseEngine(argv[i + 1], engine))
+			i++;
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	chip8RomArchive archive;
+	if (!archive.open(argv[2]))
+		return -1;
+
+	uint64_t cycles = 0;
+	size_t failed = 0, unchecked = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	for (size_t n = 0; n < archive.size(); n++)
+	{
+		const chip8ArchiveEntry& entry = archive.entry(n);
+		const uint64_t hash = chip8RomArchive::play(entry, engine);
+		cycles += entry.Cycles;
+
+		const char* result = "-";
+		if (entry.HasHash)
+		{
+			result = hash == entry.Hash ? "ok" : "FAIL";
+			failed += hash != entry.Hash;
+		}
+		else
+			unchecked++;
+
+		printf("%-32s %8s %10llu %016llx %s\n", entry.Name.c_str(), chip8RomIndex::variantName(entry.Variant), (unsigned long long)entry.Cycles,
+			(unsigned long long)hash, result);
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(end - start).count();
+
+	printf("ROMs: %zu, %zu failed, %zu without an expected screen\n", archive.size(), failed, unchecked);
+	printf("Time: %.6f s\n", seconds);
+	printf("IPS: %.0f\n", seconds > 0.0 ? cycles / seconds : 0.0);
+
+	return failed > 0 ? 2 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2) // See if we received atleast a aplication to run
+	{
+		printUsage();
+		return 1;
+	}
+
+	if (strcmp(argv[1], "-a") == 0)
+	{
+		if (argc < 3)
+		{
+			printUsage();
+			return 1;
+		}
+		return runArchive(argc, argv);
+	}
+
+	uint64_t maxCycles = 0;
+	uint64_t maxFrames = 0;
+	uint32_t speed = SCHEDULER_DEFAULT_IPS;
+	bool paced = false;
+	bool idleSkip = true;
+	const char* traceFile = NULL;
+	const char* stackFile = NULL;
+	const char* seed = NULL;
+	const char* loadState = NULL;
+	const char* saveState = NULL;
+	const char* movieFile = NULL;
+	chip8Engine engine = chip8Engine::Interpreter;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			maxCycles = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			maxFrames = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			speed = (uint32_t)strtoul(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-p") == 0)
+			paced = true;
+		else if (strcmp(argv[i], "-n") == 0)
+			idleSkip = false;
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			seed = argv[++i];
+		else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+			loadState = argv[++i];
+		else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+			saveState = argv[++i];
+		else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+			movieFile = argv[++i];
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			traceFile = argv[++i];
+		else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc)
+			stackFile = argv[++i];
+		else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc && parseEngine(argv[i + 1], engine))
+			i++;
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	chip8 CPU;
+	CPU.setEngine(engine);
+	CPU.setIdleSkip(idleSkip);
+	if (seed != NULL)
+		CPU.seedRandom(strtoull(seed, NULL, 10));
+	if (!CPU.loadApplication(argv[1]))
+		return -1;
+
+	if (loadState != NULL)
+	{
+		std::vector<uint8_t> state;
+		if (!readFile(loadState, state) || !CPU.restore(state.data(), state.size()))
+		{
+			fprintf(stderr, "Could not restore %s\n", loadState);
+			return -1;
+		}
+	}
+
+	// The movie's own state and speed, it runs up to where the recording stopped unless told otherwise
+	chip8Movie movie;
+	if (movieFile != NULL)
+	{
+		if (!movie.read(movieFile) || !movie.begin(CPU))
+		{
+			fprintf(stderr, "Could not replay %s\n", movieFile);
+			return -1;
+		}
+		speed = movie.Speed;
+		if (maxCycles == 0 && maxFrames == 0)
+			maxCycles = movie.End > CPU.getCycleCount() ? movie.End - CPU.getCycleCount() : 0;
+	}
+
+	if (maxCycles == 0 && maxFrames == 0)
+		maxCycles = DEFAULT_CYCLES;
+
+	chip8Scheduler scheduler(CPU, speed);
+	if (movieFile != NULL)
+		scheduler.play(&movie);
+	uint64_t cycles = 0;
+	uint64_t drawnFrames = 0;
+	uint64_t dirtyPixels = 0;	// What the GL renderer would have uploaded
+
+	auto start = std::chrono::steady_clock::now();
+
+	// Same frame loop as the windowed app, a frame is drawn when it leaves DrawFlag set
+	while ((maxCycles == 0 || cycles < maxCycles) && (maxFrames == 0 || scheduler.Frames < maxFrames))
+	{
+		cycles += scheduler.runFrame(maxCycles == 0 ? UINT64_MAX : maxCycles - cycles);
+
+		if (CPU.DrawFlag)
+		{
+			drawnFrames++;
+			dirtyPixels += dirtyArea(CPU.takeDirtyRegion());
+			CPU.DrawFlag = false;
+		}
+
+		if (paced)
+			scheduler.waitForFrame();
+	}
+
+	auto end = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(end - start).count();
+
+	printf("ROM: %s\n", argv[1]);
+	printf("Cycles: %llu\n", (unsigned long long)cycles);
+	printf("Frames: %llu (%llu drawn)\n", (unsigned long long)scheduler.Frames, (unsigned long long)drawnFrames);
+	if (paced)
+		printf("Late frames: %llu\n", (unsigned long long)scheduler.LateFrames);
+	if (drawnFrames > 0)
+		printf("Dirty pixels: %.1f of %d per drawn frame\n", (double)dirtyPixels / drawnFrames, GFX_WIDTH * GFX_HEIGHT);
+	printf("Time: %.6f s\n", seconds);
+	printf("IPS: %.0f\n", seconds > 0.0 ? cycles / seconds : 0.0);
+	printf("GFX hash: %016llx\n", (unsigned long long)CPU.getFramebuffer().hash());
+	printf("Idle: %llu cycles skipped\n", (unsigned long long)CPU.getIdleCycles());
+
+	if (CPU.getBlockCache() != NULL)
+		printf("Blocks: %llu translated, %llu invalidated\n", (unsigned long long)CPU.getBlockCache()->Translations, (unsigned long long)CPU.getBlockCache()->Invalidations);
+	if (CPU.getJit() != NULL)
+		printf("JIT: %llu blocks compiled, %llu arena resets\n", (unsigned long long)CPU.getJit()->Compiled, (unsigned long long)CPU.getJit()->Resets);
+
+	if (saveState != NULL)
+	{
+		std::vector<uint8_t> state;
+		CPU.snapshot(state);
+		if (!writeFile(saveState, state))
+			fprintf(stderr, "Could not write %s\n", saveState);
+		else
+			printf("State: %zu bytes written to %s\n", state.size(), saveState);
+	}
+
+	if (traceFile != NULL)
+	{
+		if (!Trace::Enabled)
+			fprintf(stderr, "Tracing is compiled out, rebuild with CHIP8_TRACE=1\n");
+		else if (!CPU.Tracer.dumpBinary(traceFile))
+			fprintf(stderr, "Could not write trace to %s\n", traceFile);
+		else
+			printf("Trace: %llu events written to %s\n", (unsigned long long)CPU.Tracer.size(), traceFile);
+	}
+
+	// Profiled builds always print the report
+	CPU.Profiler.report(stdout);
+	if (stackFile != NULL)
+	{
+		if (!Profile::Enabled)
+			fprintf(stderr, "Profiling is compiled out, rebuild with CHIP8_PROFILE=1\n");
+		else if (!CPU.Profiler.dumpFolded(stackFile))
+			fprintf(stderr, "Could not write the profile to %s\n", stackFile);
+		else
+			printf("Profile: folded stacks written to %s\n", stackFile);
+	}
+
+	return 0;
+}
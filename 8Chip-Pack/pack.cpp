@@ -0,0 +1,138 @@
+// My 8 Chip-Emu ROM packer
+// Packs ROM files into a single archive (see romarchive.h) for bulk regression runs, optionally
+// running every ROM first to record the framebuffer hash the run is expected to end with.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <vector>
+#include "chip8.h"
+#include "romfile.h"
+#include "romindex.h"
+#include "romarchive.h"
+
+// Default instructions per regression run
+#define DEFAULT_CYCLES 100000
+
+static void printUsage()
+{
+	printf("usage: 8chip-pack.exe archive ROM... [-c cycles] [-r seed] [-q quirks] [-x]\n");
+	printf("       8chip-pack.exe -l archive\n\n");
+	printf("  -c cycles   Instructions a regression run executes (default %d)\n", DEFAULT_CYCLES);
+	printf("  -r seed     Seed for the CXNN random numbers (default 0)\n");
+	printf("  -q quirks   Quirk profile bits (ARCHIVE_QUIRK_* in romarchive.h), decimal or 0x hex\n");
+	printf("  -x          Run every ROM now and store the framebuffer hash it ends with\n");
+	printf("  -l          List the ROMs in an archive\n");
+}
+
+static int list(const char* filename)
+{
+	chip8RomArchive archive;
+	if (!archive.open(filename))
+		return -1;
+
+	printf("%-32s %6s %8s %6s %10s %10s %16s\n", "ROM", "size", "variant", "quirks", "cycles", "seed", "hash");
+	for (size_t n = 0; n < archive.size(); n++)
+	{
+		const chip8ArchiveEntry& entry = archive.entry(n);
+		char hash[17] = "-";
+		if (entry.HasHash)
+			snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)entry.Hash);
+
+		printf("%-32s %6zu %8s %6x %10llu %10llu %16s\n", entry.Name.c_str(), entry.Size, chip8RomIndex::variantName(entry.Variant),
+			entry.Quirks, (unsigned long long)entry.Cycles, (unsigned long long)entry.Seed, hash);
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc == 3 && strcmp(argv[1], "-l") == 0)
+		return list(argv[2]);
+
+	if (argc < 3)
+	{
+		printUsage();
+		return 1;
+	}
+
+	std::vector<const char*> roms;
+	uint64_t cycles = DEFAULT_CYCLES;
+	uint64_t seed = 0;
+	uint16_t quirks = 0;
+	bool expect = false;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+			cycles = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			seed = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+			quirks = (uint16_t)strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-x") == 0)
+			expect = true;
+		else if (argv[i][0] != '-')
+			roms.push_back(argv[i]);
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (roms.empty())
+	{
+		printUsage();
+		return 1;
+	}
+
+	// The files stay mapped until the archive is written
+	std::vector<std::unique_ptr<chip8RomFile>> files;
+	std::vector<chip8ArchiveEntry> entries;
+	for (const char* rom : roms)
+	{
+		std::unique_ptr<chip8RomFile> file(new chip8RomFile());
+		if (!file->open(rom))
+		{
+			fprintf(stderr, "Could not open %s\n", rom);
+			return -1;
+		}
+		if (file->size() > WORKING_RAM_MAX_AMOUNT || strlen(rom) > 0xFFFF)
+		{
+			fprintf(stderr, "%s is too big for memory\n", rom);
+			return -1;
+		}
+
+		chip8ArchiveEntry entry;
+		entry.Name = rom;
+		entry.Data = file->data();
+		entry.Size = file->size();
+		entry.Quirks = quirks;
+		entry.Variant = chip8RomIndex::detectVariant(file->data(), file->size());
+		entry.Cycles = cycles;
+		entry.Seed = seed;
+		entry.HasHash = expect;
+		entry.Hash = expect ? chip8RomArchive::play(entry) : 0;
+
+		entries.push_back(entry);
+		files.push_back(std::move(file));
+	}
+
+	std::vector<uint8_t> archive;
+	if (!chip8RomArchive::write(archive, entries))
+		return -1;
+
+	FILE* pFile = openFile(argv[1], "wb");
+	const bool written = pFile != NULL && fwrite(archive.data(), 1, archive.size(), pFile) == archive.size();
+	if (pFile == NULL || fclose(pFile) != 0 || !written)
+	{
+		fprintf(stderr, "Could not write %s\n", argv[1]);
+		return -1;
+	}
+
+	printf("%zu ROMs, %zu bytes written to %s\n", entries.size(), archive.size(), argv[1]);
+	return 0;
+}